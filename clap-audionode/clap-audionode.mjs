@@ -125,6 +125,11 @@ export default class ClapAudioNode {
 		
 		function handleWorkerMessage(data) {
 			if (data?.[0] == 'thread-worker') return startThreadWorker(host, data[1]);
+			if (data?.[0] == 'state-poll') {
+				// The AudioWorklet can't set its own timers
+				setTimeout(_ => effectNode.port.postMessage(['state-poll']), data[1]);
+				return true;
+			}
 			return false;
 		}
 
@@ -160,6 +165,8 @@ export default class ClapAudioNode {
 					if (data instanceof ArrayBuffer) {
 						// it's a message from the plugin to the UI
 						if (iframe) iframe.contentWindow.postMessage(data, '*');
+						// hand the buffer back, so the AudioWorklet can reuse it
+						effectNode.port.postMessage(['webview-buffer', data], [data]);
 						return;
 					}
 					if (typeof data[0] === 'string') {
@@ -35,6 +35,7 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 	instanceMemory; // We read/write sample data directly, to avoid copying in/out of the host
 	instanceAudioPointers; // pointers to read/write audio in the Instance memory
 	instanceSingleThreaded = true;
+	backgroundState = false; // save/load state on the host's worker thread, which needs a shared Instance
 	instancePluginMap = {};
 
 	// specific to this module
@@ -83,8 +84,7 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 			Object.assign(imports.env, {
 				webviewSend: (pluginPtr, ptr, length) => {
 					let processor = this.instancePluginMap[pluginPtr];
-					let bytes = new Uint8Array(this.instanceMemory.buffer, ptr, length).slice();
-					processor.webviewSend(bytes);
+					processor.webviewSend(new Uint8Array(this.instanceMemory.buffer, ptr, length));
 				},
 				eventsOutTryPush: (pluginPtr, ptr, length) => {
 					let processor = this.instancePluginMap[pluginPtr];
@@ -98,6 +98,14 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 				paramsRescan: (pluginPtr, flags) => {
 					let processor = this.instancePluginMap[pluginPtr];
 					processor.port.postMessage(['params_rescan', flags]);
+				},
+				stateWrite: (pluginPtr, ptr, length) => {
+					let processor = this.instancePluginMap[pluginPtr];
+					return processor.stateWrite(new Uint8Array(this.instanceMemory.buffer, ptr, length));
+				},
+				stateRead: (pluginPtr, ptr, maxLength) => {
+					let processor = this.instancePluginMap[pluginPtr];
+					return processor.stateRead(new Uint8Array(this.instanceMemory.buffer, ptr, maxLength));
 				}
 			});
 			
@@ -114,6 +122,7 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 			this.hostedBytes = hostApi.createBytes(); // TODO: remove this along with destroying the plugin instance
 
 			this.instanceMemory = wclapInstance.memory;
+			this.backgroundState = !!wclapInstance.shared && typeof hostApi.pluginSaveStateAsync === 'function';
 
 			let pluginId = init.pluginId;
 			if (!pluginId) {
@@ -151,11 +160,24 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 			this.port.onmessage = async event => {
 				let data = event.data;
 				if (data instanceof ArrayBuffer) {
-					let bytes = new Uint8Array(data);
-					hostApi.pluginMessage(this.pluginPtr, this.sendBytes(bytes));
+					if (typeof hostApi.pluginMessageBuffer !== 'function') {
+						// An older `host.wasm`, which copies it across itself
+						hostApi.pluginMessage(this.pluginPtr, this.sendBytes(new Uint8Array(data)));
+						return;
+					}
+					// Written straight into the Instance's memory
+					let ptr = hostApi.pluginMessageBuffer(this.pluginPtr, data.byteLength);
+					new Uint8Array(this.instanceMemory.buffer, ptr, data.byteLength).set(new Uint8Array(data));
+					hostApi.pluginMessageReceive(this.pluginPtr, data.byteLength);
 					return;
 				}
 				let [requestId, method, args] = data;
+				if (requestId == 'webview-buffer') {
+					return this.recycleMessageBuffer(method);
+				}
+				if (requestId == 'state-poll') {
+					return this.statePollTimer();
+				}
 				if (this.fatalError) return this.port.postMessage([requestId, this.fatalError]);
 				if (requestId == 'timer-sharedArrayBuffer') {
 					return setTimerSharedArrayBuffer(method);
@@ -202,8 +224,83 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 		}
 	}
 
-	webviewSend(messageBytes) {
-		this.port.postMessage(messageBytes.buffer);
+	// Streamed state: the plugin's writes are copied straight into a growing buffer, and reads straight out of the source array
+	#stateBuffer = null;
+	#stateLength = 0;
+	stateWrite(bytes) {
+		if (!this.#stateBuffer) return -1;
+		if (this.#stateLength + bytes.length > this.#stateBuffer.byteLength) {
+			let newLength = Math.max(this.#stateBuffer.byteLength*2, this.#stateLength + bytes.length);
+			this.#stateBuffer = this.#stateBuffer.transfer(newLength);
+		}
+		new Uint8Array(this.#stateBuffer, this.#stateLength, bytes.length).set(bytes);
+		this.#stateLength += bytes.length;
+		return bytes.length;
+	}
+	stateRead(bytes) {
+		if (!this.#stateBuffer) return -1;
+		let length = Math.min(bytes.length, this.#stateBuffer.byteLength - this.#stateLength);
+		bytes.set(new Uint8Array(this.#stateBuffer, this.#stateLength, length));
+		this.#stateLength += length;
+		return length;
+	}
+
+	// Background state requests, resolved (from `process()`, or a timer in case we're not processing) when they finish
+	#stateRequests = new Map();
+	stateRequest(requestId, isSave) {
+		return new Promise(resolve => {
+			this.#stateRequests.set(requestId, {resolve, isSave});
+			this.armStatePoll();
+		});
+	}
+	#statePollArmed = false;
+	armStatePoll() {
+		if (this.#statePollArmed || !this.#stateRequests.size) return;
+		this.#statePollArmed = true;
+		if (typeof setTimeout === 'function') {
+			setTimeout(_ => this.statePollTimer(), 5);
+		} else {
+			// AudioWorkletGlobalScope has no timers, so the main thread sends this back after a delay
+			this.port.postMessage(['state-poll', 5]);
+		}
+	}
+	statePollTimer() {
+		this.#statePollArmed = false;
+		this.pollStateRequests();
+		this.armStatePoll(); // until they've all finished
+	}
+	pollStateRequests() {
+		this.#stateRequests.forEach((request, requestId) => {
+			if (this.hostApi.pluginStateRequestStatus(this.pluginPtr, requestId) == 0/*pending*/) return;
+			this.#stateRequests.delete(requestId);
+			let success = this.hostApi.pluginFinishStateRequest(this.pluginPtr, requestId, this.hostedBytes);
+			if (request.isSave) {
+				request.resolve(success ? this.getBytes().buffer : null);
+			} else {
+				request.resolve(success);
+			}
+		});
+	}
+
+	// Outgoing messages are copied once into a (resizable) buffer which is transferred, and the main thread sends it back to be reused
+	#messageBuffers = [];
+	webviewSend(instanceBytes) {
+		let length = instanceBytes.length;
+		let buffer = this.#messageBuffers.pop();
+		if (!buffer || buffer.maxByteLength < length) {
+			let capacity = 4096;
+			while (capacity < length) capacity *= 2;
+			buffer = new ArrayBuffer(length, {maxByteLength: capacity});
+		} else {
+			buffer.resize(length);
+		}
+		new Uint8Array(buffer).set(instanceBytes);
+		this.port.postMessage(buffer, [buffer]);
+	}
+	recycleMessageBuffer(buffer) {
+		if (buffer instanceof ArrayBuffer && buffer.resizable && this.#messageBuffers.length < 8) {
+			this.#messageBuffers.push(buffer);
+		}
 	}
 
 	remoteMethods = {
@@ -222,15 +319,59 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 			}
 		},
 		saveState() {
-			// TODO: transfer ownership, to avoid allocation/GC from this
-			if (!this.hostApi.pluginSaveState(this.pluginPtr, this.hostedBytes)) {
-				return null;
+			if (this.backgroundState) {
+				// On the host's background thread, so a slow plugin doesn't stall the audio
+				return this.stateRequest(this.hostApi.pluginSaveStateAsync(this.pluginPtr), true);
+			}
+			if (typeof this.hostApi.pluginSaveStateStreaming !== 'function') {
+				// An older `host.wasm`, which saves into a single buffer
+				if (!this.hostApi.pluginSaveState(this.pluginPtr, this.hostedBytes)) return null;
+				return this.getBytes();
 			}
-			return this.getBytes();
+			this.#stateBuffer = new ArrayBuffer(65536);
+			this.#stateLength = 0;
+			let success = this.hostApi.pluginSaveStateStreaming(this.pluginPtr);
+			let stateBuffer = this.#stateBuffer;
+			this.#stateBuffer = null;
+			if (!success) return null;
+			return stateBuffer.transfer(this.#stateLength);
 		},
 		loadState(stateArray) {
-			let bytes = new Uint8Array(stateArray);
-			return this.hostApi.pluginLoadState(this.pluginPtr, this.sendBytes(bytes));
+			if (this.backgroundState) {
+				let bytes = ArrayBuffer.isView(stateArray) ? stateArray : new Uint8Array(stateArray);
+				return this.stateRequest(this.hostApi.pluginLoadStateAsync(this.pluginPtr, this.sendBytes(bytes)), false);
+			}
+			if (typeof this.hostApi.pluginLoadStateStreaming !== 'function') {
+				return this.hostApi.pluginLoadState(this.pluginPtr, this.sendBytes(new Uint8Array(stateArray)));
+			}
+			this.#stateBuffer = ArrayBuffer.isView(stateArray) ? stateArray.buffer.slice(stateArray.byteOffset, stateArray.byteOffset + stateArray.byteLength) : stateArray;
+			this.#stateLength = 0; // read position
+			let success = this.hostApi.pluginLoadStateStreaming(this.pluginPtr);
+			this.#stateBuffer = null;
+			return success;
+		},
+		// Saved state is compressed by the host (`loadState()` accepts either)
+		setStateCompression(enabled) {
+			this.hostApi.pluginSetStateCompression(this.pluginPtr, !!enabled);
+		},
+		// Undo history, kept (deduplicated) in the host - returns an ID, or `null`
+		saveSnapshot() {
+			return this.hostApi.pluginSaveSnapshot(this.pluginPtr) || null;
+		},
+		loadSnapshot(snapshotId) {
+			return this.hostApi.pluginLoadSnapshot(this.pluginPtr, snapshotId);
+		},
+		removeSnapshot(snapshotId) {
+			return this.hostApi.pluginRemoveSnapshot(this.pluginPtr, snapshotId);
+		},
+		snapshotStats() {
+			return this.decodeCbor(this.hostApi.pluginGetSnapshotStats(this.pluginPtr, this.hostedBytes));
+		},
+		// Instance-memory use: the module's arenas (shared by its plugins) and this plugin's own
+		memoryStats() {
+			let host = this.decodeCbor(this.hostApi.getMemoryStats(this.hostedWclapPtr, this.hostedBytes));
+			let plugin = this.decodeCbor(this.hostApi.pluginGetMemoryStats(this.pluginPtr, this.hostedBytes));
+			return {host, plugin};
 		},
 		setParam(paramId, value) {
 			this.hostApi.pluginSetParam(this.pluginPtr, paramId, value);
@@ -240,22 +381,73 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 			
 			return this.remoteMethods.getParam.call(this, paramId);
 		},
+		// `values` and `ids` are arrays (or typed arrays) of the same length
+		setParams(ids, values) {
+			let count = ids.length;
+			let bufferPtr = this.hostApi.resizeBytes(this.hostedBytes, count*12);
+			new Float64Array(this.host.hostMemory.buffer, bufferPtr, count).set(values);
+			new Uint32Array(this.host.hostMemory.buffer, bufferPtr + count*8, count).set(ids);
+			let queued = this.hostApi.pluginSetParams(this.pluginPtr, this.hostedBytes, count);
+			this.hostApi.pluginParamsFlush(this.pluginPtr);
+			return queued;
+		},
 		getParam(paramId) {
-			return this.decodeCbor(this.hostApi.pluginGetParam(this.pluginPtr, paramId, this.hostedBytes));
+			if (typeof this.hostApi.pluginGetParamValue !== 'function') {
+				// An older `host.wasm`, which only has the CBOR version
+				return this.decodeCbor(this.hostApi.pluginGetParam(this.pluginPtr, paramId, this.hostedBytes));
+			}
+			// Fixed-layout result: {double value, uint32 flags, uint32 textLength, char text[256]}
+			let resultPtr = this.hostApi.pluginGetParamValue(this.pluginPtr, paramId, true);
+			let dataView = new DataView(this.host.hostMemory.buffer, resultPtr, 272);
+			let flags = dataView.getUint32(8, true);
+			if (!(flags&1)) return null;
+			let result = {value: dataView.getFloat64(0, true)};
+			if (flags&2) {
+				// Have to copy because the TextDecoder doesn't like shared buffers
+				let textBytes = new Uint8Array(this.host.hostMemory.buffer, resultPtr + 16, dataView.getUint32(12, true)).slice();
+				result.text = (this.textDecoder ??= new TextDecoder()).decode(textBytes);
+			}
+			return result;
 		},
 		getParams() {
+			// Values come from the host's cache, and text is only present if it's been formatted already (use `getParam()` for that)
 			let params = this.decodeCbor(this.hostApi.pluginGetParams(this.pluginPtr, this.hostedBytes));
 			params.forEach(param => {
-				param.value = this.remoteMethods.getParam.call(this, param.id);
+				if (!('value' in param)) {
+					// An older `host.wasm` which doesn't cache values: ask for each one
+					param.value = this.remoteMethods.getParam.call(this, param.id);
+					return;
+				}
+				param.value = {value: param.value, text: param.text};
+				delete param.text;
 			});
 			return params;
 		},
+		// Parameters changed by the plugin since the last call
+		pollParams() {
+			let count = this.hostApi.pluginPollParams(this.pluginPtr, this.hostedBytes);
+			if (!count) return [];
+			let dataView = new DataView(this.getBytes().buffer);
+			let changes = [];
+			for (let i = 0; i < count; ++i) {
+				changes.push({
+					value: dataView.getFloat64(i*16, true),
+					id: dataView.getUint32(i*16 + 8, true),
+					gesture: !!(dataView.getUint32(i*16 + 12, true)&1)
+				});
+			}
+			return changes;
+		},
 		performance() {
 			return {js: this.#averageJsMs, wasm: this.#averageWasmMs, block: this.#averageBlockMs};
 		},
 		getResource(path) {
 			return this.decodeCbor(this.hostApi.pluginGetResource(this.pluginPtr, this.encodeString(path)));
 		},
+		// Resources are cached by the host until this (or until the plugin is destroyed)
+		flushResources() {
+			this.hostApi.pluginFlushResources(this.pluginPtr);
+		},
 		webviewOpen(isOpen, isVisible) {
 			// TODO: let the `clap.gui` extension know
 		}
@@ -267,6 +459,7 @@ class ClapAudioWorkletProcessor extends AudioWorkletProcessor {
 	
 	process(inputs, outputs, parameters) {
 		let jsStartTime = now();
+		if (this.#stateRequests.size) this.pollStateRequests();
 		if (this.fatalError || !this.running) return false; // outputs are pre-filled with silence
 
 		let blockLength = (outputs[0] || inputs[0])[0].length;
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+/* Accounting for the host's use of the Instance-memory arenas, to find growth in long-running sessions.
+
+The arenas don't report their own usage, so the host counts what it does with them: arenas it keeps (global, per-plugin, webview messages, streams) and the bytes it's placed in those, plus the temporary `scoped()` arenas used within a call - including any held for longer than a call should take.
+
+Every arena the host holds (kept or temporary) came from the pool, so the high-water mark of `arenas` is how many the pool has had to create.*/
+struct ArenaAccounting {
+	using Clock = std::chrono::steady_clock;
+	static constexpr uint64_t longScopeNs = 100000000; // 100ms
+
+	// A current value and its high-water mark
+	struct Level {
+		std::atomic<uint64_t> current{0}, highWater{0};
+
+		void add(uint64_t n) {
+			auto value = current.fetch_add(n, std::memory_order_relaxed) + n;
+			auto high = highWater.load(std::memory_order_relaxed);
+			while (value > high && !highWater.compare_exchange_weak(high, value, std::memory_order_relaxed)) {}
+		}
+		void remove(uint64_t n) {
+			current.fetch_sub(n, std::memory_order_relaxed);
+		}
+	};
+	enum Kind {KEPT_GLOBAL, KEPT_PLUGIN, KEPT_MESSAGE, KEPT_STREAM, KEPT_KINDS};
+	static constexpr const char *kindNames[KEPT_KINDS] = {"global", "plugin", "message", "stream"};
+	struct Kept {
+		Level arenas, bytes;
+	};
+	Kept kept[KEPT_KINDS];
+	Level arenas, keptBytes, scopes;
+	std::atomic<uint64_t> scopeCount{0}, longScopes{0}, longestScopeNs{0};
+
+	// An arena taken from the pool and kept beyond the current call
+	void keep(Kind kind, uint64_t bytes) {
+		arenas.add(1);
+		kept[kind].arenas.add(1);
+		kept[kind].bytes.add(bytes);
+		keptBytes.add(bytes);
+	}
+	void release(Kind kind, uint64_t bytes) {
+		keptBytes.remove(bytes);
+		kept[kind].bytes.remove(bytes);
+		kept[kind].arenas.remove(1);
+		arenas.remove(1);
+	}
+	// More (or fewer) bytes placed in an arena which is already kept
+	void resize(Kind kind, uint64_t oldBytes, uint64_t newBytes) {
+		if (newBytes > oldBytes) {
+			kept[kind].bytes.add(newBytes - oldBytes);
+			keptBytes.add(newBytes - oldBytes);
+		} else {
+			kept[kind].bytes.remove(oldBytes - newBytes);
+			keptBytes.remove(oldBytes - newBytes);
+		}
+	}
+
+	// Counts a temporary arena for as long as it exists (see `TempArena`)
+	struct Scope {
+		Scope(ArenaAccounting &accounting) : accounting(accounting), start(Clock::now()) {
+			accounting.arenas.add(1);
+			accounting.scopes.add(1);
+			accounting.scopeCount.fetch_add(1, std::memory_order_relaxed);
+		}
+		Scope(const Scope &other) = delete;
+		~Scope() {
+			uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+			if (ns > longScopeNs) accounting.longScopes.fetch_add(1, std::memory_order_relaxed);
+			auto longest = accounting.longestScopeNs.load(std::memory_order_relaxed);
+			while (ns > longest && !accounting.longestScopeNs.compare_exchange_weak(longest, ns, std::memory_order_relaxed)) {}
+			accounting.scopes.remove(1);
+			accounting.arenas.remove(1);
+		}
+	private:
+		ArenaAccounting &accounting;
+		Clock::time_point start;
+	};
+	// A temporary `pool.scoped()` arena, counted as a `Scope` - use it like the plain `Scoped`, but don't `commit()` it
+	template<class Pool>
+	struct TempArena : Scope, decltype(std::declval<Pool &>().scoped()) {
+		using Scoped = decltype(std::declval<Pool &>().scoped());
+		TempArena(ArenaAccounting &accounting, Pool &pool) : Scope(accounting), Scoped(pool.scoped()) {}
+	};
+	template<class Pool>
+	TempArena<Pool> temp(Pool &pool) {
+		return {*this, pool};
+	}
+};
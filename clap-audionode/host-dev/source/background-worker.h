@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/* A single background thread, which runs jobs in the order they're posted.  The thread isn't started until the first job arrives.
+
+The jobs call into the `Instance`, so (as with `GraphScheduler`) it must support calls from several threads.*/
+struct BackgroundWorker {
+	~BackgroundWorker() {
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			stopping = true;
+		}
+		condition.notify_all();
+		if (thread.joinable()) thread.join();
+	}
+
+	void post(std::function<void()> job) {
+		{
+			std::lock_guard<std::mutex> lock{mutex};
+			jobs.push_back(std::move(job));
+			if (!thread.joinable()) thread = std::thread([this](){workerLoop();});
+		}
+		condition.notify_one();
+	}
+
+private:
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<std::function<void()>> jobs;
+	bool stopping = false;
+	std::thread thread;
+
+	void workerLoop() {
+		std::unique_lock<std::mutex> lock{mutex};
+		while (true) {
+			condition.wait(lock, [this](){return stopping || !jobs.empty();});
+			if (jobs.empty()) return; // only when stopping, and finished everything
+			auto job = std::move(jobs.front());
+			jobs.pop_front();
+			lock.unlock();
+			job();
+			lock.lock();
+		}
+	}
+};
@@ -1,9 +1,25 @@
 #pragma once
 
-// Use `wclap-cpp` and the JS implementation of Instance
+#include <iostream>
+#ifndef LOG_EXPR
+#	define LOG_EXPR(expr) std::cout << #expr " = " << (expr) << std::endl;
+#endif
+
+// Use `wclap-cpp` and the JS implementation of Instance (or the in-process one, for native builds)
 #include "wclap/wclap.hpp"
+#ifdef WCLAP_HOST_NATIVE
+#	include "./native/native-instance.h"
+#else
+#	include "./wclap-js-instance.h"
+#endif
 #include "wclap/memory-arena.hpp"
-#include "./wclap-js-instance.h"
+
+// Functions provided by the JS side (see `native/native-imports.cpp` for the native stand-ins)
+#ifdef WCLAP_HOST_NATIVE
+#	define WCLAP_HOST_IMPORT(name)
+#else
+#	define WCLAP_HOST_IMPORT(name) __attribute__((import_module("env"), import_name(name)))
+#endif
 
 // We read/write compound values as CBOR
 #include "cbor-walker/cbor-walker.h"
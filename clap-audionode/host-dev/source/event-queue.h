@@ -0,0 +1,97 @@
+#pragma once
+
+#include "./common.h"
+
+#include <atomic>
+#include <vector>
+#include <cstring>
+
+namespace impl32 {
+using namespace wclap32;
+
+/* Wait-free single-producer/single-consumer queue of variable-size events.
+
+Events are stored back-to-back (each aligned to 8 bytes) in a fixed-size ring.  If an event doesn't fit before the end of the ring, a zero `size` is written as a marker, and the event starts again from the beginning.
+
+Neither side locks or allocates: when the ring is full, `push()` returns `false` and increments the overflow counter.*/
+struct EventQueue {
+	static constexpr size_t alignment = 8;
+
+	EventQueue(size_t capacityBytes=65536) {
+		capacity = alignment;
+		while (capacity < capacityBytes) capacity *= 2;
+		buffer.resize(capacity);
+	}
+
+	size_t capacityBytes() const {
+		return capacity;
+	}
+	uint32_t overflowCount() const {
+		return overflows.load(std::memory_order_relaxed);
+	}
+
+	// Producer thread only
+	bool push(const wclap_event_header *event) {
+		size_t eventSize = event->size;
+		if (eventSize < sizeof(wclap_event_header)) return false; // invalid event, not an overflow
+		size_t paddedSize = padded(eventSize);
+
+		size_t write = writeIndex.load(std::memory_order_relaxed);
+		size_t read = readIndex.load(std::memory_order_acquire);
+		size_t offset = write&(capacity - 1);
+		size_t skip = (paddedSize > capacity - offset) ? capacity - offset : 0;
+		if (write + skip + paddedSize - read > capacity) {
+			overflows.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+		if (skip) {
+			// Marker so the reader knows to wrap around
+			uint32_t zero = 0;
+			std::memcpy(buffer.data() + offset, &zero, sizeof(zero));
+			write += skip;
+			offset = 0;
+		}
+		std::memcpy(buffer.data() + offset, event, eventSize);
+		writeIndex.store(write + paddedSize, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer thread only: calls `fn(const wclap_event_header *)` for each queued event, then releases the space
+	template<class Fn>
+	size_t drain(Fn &&fn) {
+		size_t read = readIndex.load(std::memory_order_relaxed);
+		size_t write = writeIndex.load(std::memory_order_acquire);
+		size_t count = 0;
+		while (read != write) {
+			size_t offset = read&(capacity - 1);
+			uint32_t eventSize;
+			std::memcpy(&eventSize, buffer.data() + offset, sizeof(eventSize));
+			if (!eventSize) { // wrap marker
+				read += capacity - offset;
+				continue;
+			}
+			fn((const wclap_event_header *)(buffer.data() + offset));
+			read += padded(eventSize);
+			++count;
+		}
+		readIndex.store(read, std::memory_order_release);
+		return count;
+	}
+
+	// Consumer thread only
+	void clear() {
+		readIndex.store(writeIndex.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+private:
+	size_t capacity;
+	std::vector<unsigned char> buffer;
+	std::atomic<size_t> readIndex{0}, writeIndex{0};
+	std::atomic<uint32_t> overflows{0};
+
+	static size_t padded(size_t size) {
+		return (size + alignment - 1)&~(alignment - 1);
+	}
+};
+
+} // namespace
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Runs a DAG of tasks (e.g. plugins) each quantum, across a pool of pre-spawned threads.
+
+Each task has an atomic count of unfinished dependencies: whoever finishes the last dependency pushes it onto a shared ready-list, which every thread (including the caller) claims work from.  The caller never blocks on the pool: it runs any ready tasks itself, and only waits for tasks which another thread has already claimed.
+
+`run()` opens a quantum with a single atomic store, and never takes a lock.  Between quanta, the pool threads spin (yielding) for a while, so back-to-back quanta don't need waking.  Past that they sleep on a condition variable, and `run()` only notifies it if one of them is asleep.  A notification can slip in just before a thread actually sleeps, so they also wake up on a short timeout - a late thread just means the caller runs more of that quantum itself.
+
+If a quantum overruns its deadline, the scheduler falls back to running serially for a while (in case the pool is being starved), then tries again.
+
+The task function runs on pool threads, so the underlying `Instance` must support calls from several threads.*/
+struct GraphScheduler {
+	GraphScheduler(size_t threadCount) {
+		for (size_t i = 0; i < threadCount; ++i) {
+			threads.emplace_back([this](){workerLoop();});
+		}
+	}
+	~GraphScheduler() {
+		{
+			std::lock_guard<std::mutex> lock{wakeMutex};
+			quit = true;
+		}
+		wakeCondition.notify_all();
+		for (auto &thread : threads) thread.join();
+	}
+
+	size_t threadCount() const {
+		return threads.size();
+	}
+
+	// Not real-time safe: call while no `run()` is in progress
+	void setGraph(const std::vector<std::vector<uint32_t>> &dependents, std::function<void(uint32_t)> task) {
+		taskCount = dependents.size();
+		this->dependents = dependents;
+		this->task = std::move(task);
+		dependencyCounts.assign(taskCount, 0);
+		for (auto &list : dependents) {
+			for (auto d : list) ++dependencyCounts[d];
+		}
+		pending.reset(new std::atomic<uint32_t>[taskCount]);
+		readySlots.reset(new std::atomic<int32_t>[taskCount]);
+	}
+
+	using Clock = std::chrono::steady_clock;
+	// Decides (on the `run()` thread) whether a quantum which took `elapsed` missed its deadline
+	using DeadlineCheck = std::function<bool(Clock::duration elapsed)>;
+
+	// Not real-time safe: call while no `run()` is in progress
+	void setDeadline(double seconds) {
+		auto deadline = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+		deadlineMissed = [deadline](Clock::duration elapsed){
+			return elapsed > deadline;
+		};
+	}
+	void setDeadlineCheck(DeadlineCheck check) {
+		deadlineMissed = std::move(check);
+	}
+	// Counts how many quanta ran serially after missing the deadline
+	uint64_t fallbackCount() const {
+		return fallbackQuanta.load(std::memory_order_relaxed);
+	}
+
+	// Runs every task once, respecting dependencies - returns when they're all complete
+	void run(const std::vector<uint32_t> &serialOrder) {
+		if (threads.empty() || serialCountdown > 0) {
+			if (serialCountdown > 0) {
+				--serialCountdown;
+				fallbackQuanta.fetch_add(1, std::memory_order_relaxed);
+			}
+			for (auto t : serialOrder) task(t);
+			return;
+		}
+		auto startTime = Clock::now();
+
+		for (size_t t = 0; t < taskCount; ++t) {
+			pending[t].store(dependencyCounts[t], std::memory_order_relaxed);
+			readySlots[t].store(-1, std::memory_order_relaxed);
+		}
+		readyRead.store(0, std::memory_order_relaxed);
+		readyWrite.store(0, std::memory_order_relaxed);
+		remaining.store(taskCount, std::memory_order_relaxed);
+		for (size_t t = 0; t < taskCount; ++t) {
+			if (!dependencyCounts[t]) pushReady(uint32_t(t));
+		}
+
+		// Odd generation means a quantum is open for workers to join
+		auto gen = generation.load(std::memory_order_relaxed) + 1;
+		generation.store(gen);
+		if (sleepingWorkers.load() > 0) wakeCondition.notify_all();
+
+		while (remaining.load(std::memory_order_acquire) > 0) {
+			if (!tryRunOne()) std::this_thread::yield(); // waiting for another thread's task to finish
+		}
+
+		// Barrier: close the quantum, and wait for workers to leave before anything is reset
+		generation.store(gen + 1);
+		while (activeWorkers.load() > 0) std::this_thread::yield();
+
+		if (deadlineMissed && deadlineMissed(Clock::now() - startTime)) {
+			serialCountdown = serialFallbackQuanta;
+		}
+	}
+
+private:
+	static constexpr int serialFallbackQuanta = 64;
+	static constexpr std::chrono::microseconds spinBeforeSleep{1000}, sleepTimeout{1000};
+
+	std::vector<std::thread> threads;
+	std::atomic<bool> quit{false};
+	std::mutex wakeMutex; // only taken by the pool threads (to sleep) and the destructor
+	std::condition_variable wakeCondition;
+	std::atomic<int> sleepingWorkers{0};
+
+	size_t taskCount = 0;
+	std::vector<std::vector<uint32_t>> dependents;
+	std::vector<uint32_t> dependencyCounts;
+	std::function<void(uint32_t)> task;
+
+	std::unique_ptr<std::atomic<uint32_t>[]> pending;
+	std::unique_ptr<std::atomic<int32_t>[]> readySlots; // each task becomes ready exactly once per quantum
+	std::atomic<size_t> readyRead{0}, readyWrite{0}, remaining{0};
+	std::atomic<uint64_t> generation{0};
+	std::atomic<int> activeWorkers{0};
+
+	DeadlineCheck deadlineMissed;
+	int serialCountdown = 0;
+	std::atomic<uint64_t> fallbackQuanta{0};
+
+	void pushReady(uint32_t t) {
+		auto slot = readyWrite.fetch_add(1, std::memory_order_acq_rel);
+		readySlots[slot].store(int32_t(t), std::memory_order_release);
+	}
+	bool tryRunOne() {
+		auto read = readyRead.load(std::memory_order_acquire);
+		while (read < readyWrite.load(std::memory_order_acquire)) {
+			int32_t t = readySlots[read].load(std::memory_order_acquire);
+			if (t < 0) return false; // slot reserved but not filled in yet
+			if (readyRead.compare_exchange_weak(read, read + 1, std::memory_order_acq_rel)) {
+				task(uint32_t(t));
+				for (auto d : dependents[t]) {
+					if (pending[d].fetch_sub(1, std::memory_order_acq_rel) == 1) pushReady(d);
+				}
+				remaining.fetch_sub(1, std::memory_order_acq_rel);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void workerLoop() {
+		uint64_t seen = 0;
+		while (true) {
+			uint64_t gen;
+			auto isOpen = [&](){
+				gen = generation.load();
+				return (gen&1) && gen != seen;
+			};
+			// Wait until there's a quantum we haven't joined yet: spinning at first, then sleeping
+			auto spinUntil = Clock::now() + spinBeforeSleep;
+			while (!isOpen() && !quit && Clock::now() < spinUntil) std::this_thread::yield();
+			if (!isOpen()) {
+				std::unique_lock<std::mutex> lock{wakeMutex};
+				sleepingWorkers.fetch_add(1);
+				while (!quit && !isOpen()) wakeCondition.wait_for(lock, sleepTimeout);
+				sleepingWorkers.fetch_sub(1);
+			}
+			if (quit) return;
+			seen = gen;
+			// Only touch the quantum's state if it's still open after we've registered
+			activeWorkers.fetch_add(1);
+			while (generation.load() == gen) {
+				if (!tryRunOne()) std::this_thread::yield();
+			}
+			activeWorkers.fetch_sub(1);
+		}
+	}
+};
@@ -1,13 +1,10 @@
-#include <iostream>
-#ifndef LOG_EXPR
-#	define LOG_EXPR(expr) std::cout << #expr " = " << (expr) << std::endl;
-#endif
-
 /*
 	Hosts WCLAP instances, manages plugins, and exports a simpler API for use from JS
 */
 #include "./hosted-wclap.h"
 #include "./hosted-plugin.h"
+#include "./plugin-graph.h"
+#include "./offline-render.h"
 
 #include "./cbor-bytes.h"
 
@@ -23,13 +20,34 @@ extern "C" {
 		return hosted->getInfo(cbor);
 	}
 
+	// Keeps `size` plugins with this ID (from `bytes`) created in advance, for `createPlugin()` to hand out
+	void setWarmPoolSize(HostedWclap *hosted, Bytes *bytes, uint32_t size) {
+		hosted->setWarmPoolSize(bytes->readString(), size);
+	}
+	// Call when the main thread is idle: creates up to `maxCount` plugins, returning how many it created
+	uint32_t refillWarmPools(HostedWclap *hosted, uint32_t maxCount) {
+		return uint32_t(hosted->refillWarmPools(maxCount));
+	}
+	void getWarmPoolStats(HostedWclap *hosted, Bytes *bytes) {
+		auto cbor = bytes->write();
+		hosted->getWarmPoolStats(cbor);
+	}
+	// Arenas and bytes the host holds in the Instance's memory, with high-water marks (poll this to spot growth)
+	void getMemoryStats(HostedWclap *hosted, Bytes *bytes) {
+		auto cbor = bytes->write();
+		hosted->getMemoryStats(cbor);
+	}
+
 	HostedPlugin * createPlugin(HostedWclap *hosted, Bytes *bytes) {
 		auto pluginId = bytes->readString();
 		LOG_EXPR(pluginId);
 		return hosted->createPlugin(pluginId.c_str());
 	}
-	void destroyPlugin(HostedPlugin *plugin) {
+	// Fails (without destroying anything) if the plugin is still in a graph - destroy the graph first
+	bool destroyPlugin(HostedPlugin *plugin) {
+		if (plugin->graph) return false;
 		delete plugin;
+		return true;
 	}
 	void pluginMainThread(HostedPlugin *plugin) {
 		plugin->mainThread();
@@ -41,10 +59,23 @@ extern "C" {
 	void pluginMessage(HostedPlugin *plugin, Bytes *bytes) {
 		plugin->message(bytes->buffer.data(), bytes->buffer.size());
 	}
+	// A buffer in the Instance's memory (valid until the next call) for JS to write a message into, then deliver with `pluginMessageReceive()`
+	uint32_t pluginMessageBuffer(HostedPlugin *plugin, uint32_t length) {
+		return plugin->messageBuffer(length).wasmPointer;
+	}
+	void pluginMessageReceive(HostedPlugin *plugin, uint32_t length) {
+		plugin->receiveMessage(length);
+	}
 	bool pluginGetResource(HostedPlugin *plugin, Bytes *bytes) {
 		auto pathStr = bytes->readString();
-		auto cbor = bytes->write();
-		return plugin->getResource(pathStr, cbor);
+		return plugin->getResource(pathStr, bytes->buffer);
+	}
+	// Drops cached resources (e.g. when the UI files might have changed)
+	void pluginFlushResources(HostedPlugin *plugin) {
+		plugin->resourceCache.flush();
+	}
+	void pluginSetResourceCacheSize(HostedPlugin *plugin, uint32_t maxBytes) {
+		plugin->resourceCache.setMaxBytes(maxBytes);
 	}
 	void pluginGetParams(HostedPlugin *plugin, Bytes *bytes) {
 		auto cbor = bytes->write();
@@ -54,9 +85,39 @@ extern "C" {
 		auto cbor = bytes->write();
 		plugin->getParam(paramId, cbor);
 	}
+	// Returns the number of changed parameters, as packed `{double value, uint32_t id, uint32_t flags}` entries in `bytes`
+	uint32_t pluginPollParams(HostedPlugin *plugin, Bytes *bytes) {
+		return uint32_t(plugin->pollParams(bytes->buffer));
+	}
 	void pluginSetParam(HostedPlugin *plugin, uint32_t paramId, double value) {
 		plugin->setParam(paramId, value);
 	}
+	// Returns a pointer to a `{double value, uint32_t flags, uint32_t textLength, char text[256]}` struct, valid until the next call
+	const void * pluginGetParamValue(HostedPlugin *plugin, uint32_t paramId, bool withText) {
+		return plugin->getParamValue(paramId, withText);
+	}
+	// `bytes` holds `count` doubles (values) followed by `count` uint32s (IDs)
+	uint32_t pluginSetParams(HostedPlugin *plugin, Bytes *bytes, uint32_t count) {
+		if (bytes->buffer.size() < size_t(count)*(sizeof(double) + sizeof(uint32_t))) return 0;
+		return plugin->setParams(bytes->buffer.data(), count);
+	}
+	bool pluginScheduleParam(HostedPlugin *plugin, uint32_t paramId, double value, uint32_t time) {
+		return plugin->setParam(paramId, value, time);
+	}
+	bool pluginScheduleParamMod(HostedPlugin *plugin, uint32_t paramId, double amount, uint32_t time) {
+		return plugin->modParam(paramId, amount, time);
+	}
+	// flags: 1 = PARAM_MOD instead of PARAM_VALUE, 2 = exponential
+	bool pluginRampParam(HostedPlugin *plugin, uint32_t paramId, double from, double to, uint32_t time, uint32_t duration, uint32_t flags) {
+		return plugin->rampParam(paramId, from, to, time, duration, flags);
+	}
+	void pluginSetRampOptions(HostedPlugin *plugin, uint32_t stepFrames, bool splitBlocks) {
+		plugin->setRampOptions(stepFrames, splitBlocks);
+	}
+	// Bytes of events each block can take (and hold back for later blocks) - call while stopped
+	bool pluginSetEventBudget(HostedPlugin *plugin, uint32_t bytes) {
+		return plugin->setEventBudget(bytes);
+	}
 	void pluginParamsFlush(HostedPlugin *plugin) {
 		plugin->paramsFlush();
 	}
@@ -64,12 +125,30 @@ extern "C" {
 		auto cbor = bytes->write();
 		return plugin->start(sRate, minFrames, maxFrames, cbor);
 	}
+	// Rebinds a channel to a buffer in the Instance's memory (0 = its own buffer) - call between blocks, on the audio thread
+	bool pluginBindAudio(HostedPlugin *plugin, bool isOutput, uint32_t port, uint32_t channel, uint32_t instancePtr) {
+		return plugin->bindAudio(isOutput, port, channel, {instancePtr});
+	}
+	uint32_t pluginBoundAudio(HostedPlugin *plugin, bool isOutput, uint32_t port, uint32_t channel) {
+		return plugin->boundAudio(isOutput, port, channel).wasmPointer;
+	}
+	bool pluginBindInPlace(HostedPlugin *plugin, uint32_t outputPort) {
+		return plugin->bindInPlace(outputPort);
+	}
 	void pluginStop(HostedPlugin *plugin) {
 		return plugin->stop();
 	}
 	bool pluginAcceptEvent(HostedPlugin *plugin, Bytes *bytes) {
 		return plugin->acceptEvent(bytes->buffer.data());
 	}
+	void pluginGetEventStats(HostedPlugin *plugin, Bytes *bytes) {
+		auto cbor = bytes->write();
+		plugin->getEventStats(cbor);
+	}
+	void pluginGetMemoryStats(HostedPlugin *plugin, Bytes *bytes) {
+		auto cbor = bytes->write();
+		plugin->getMemoryStats(cbor);
+	}
 
 	bool pluginSaveState(HostedPlugin *plugin, Bytes *bytes) {
 		return plugin->saveState(bytes->buffer);
@@ -77,8 +156,108 @@ extern "C" {
 	bool pluginLoadState(HostedPlugin *plugin, Bytes *bytes) {
 		return plugin->loadState(bytes->buffer);
 	}
+	// Save/load on the host's background thread, returning a request ID to poll
+	uint32_t pluginSaveStateAsync(HostedPlugin *plugin) {
+		return plugin->saveStateAsync();
+	}
+	uint32_t pluginLoadStateAsync(HostedPlugin *plugin, Bytes *bytes) {
+		return plugin->loadStateAsync(std::move(bytes->buffer));
+	}
+	// 0 = pending, 1 = done, -1 = failed, -2 = unknown request
+	int32_t pluginStateRequestStatus(HostedPlugin *plugin, uint32_t requestId) {
+		return plugin->stateRequestStatus(requestId);
+	}
+	// Forgets a finished request, putting its saved state (if any) in `bytes`
+	bool pluginFinishStateRequest(HostedPlugin *plugin, uint32_t requestId, Bytes *bytes) {
+		bytes->buffer.resize(0);
+		return plugin->finishStateRequest(requestId, bytes->buffer);
+	}
+	// Saved state uses a compressed envelope (loading accepts both)
+	void pluginSetStateCompression(HostedPlugin *plugin, bool compress) {
+		plugin->compressState = compress;
+	}
+	// Deduplicated snapshots, kept in the host - returns 0 on failure
+	uint32_t pluginSaveSnapshot(HostedPlugin *plugin) {
+		return plugin->saveSnapshot();
+	}
+	bool pluginLoadSnapshot(HostedPlugin *plugin, uint32_t snapshotId) {
+		return plugin->loadSnapshot(snapshotId);
+	}
+	bool pluginRemoveSnapshot(HostedPlugin *plugin, uint32_t snapshotId) {
+		return plugin->removeSnapshot(snapshotId);
+	}
+	void pluginGetSnapshotStats(HostedPlugin *plugin, Bytes *bytes) {
+		auto cbor = bytes->write();
+		plugin->getSnapshotStats(cbor);
+	}
+	// The state goes through the `stateWrite`/`stateRead` imports, in whatever chunks the plugin uses
+	bool pluginSaveStateStreaming(HostedPlugin *plugin) {
+		return plugin->saveStateStreaming();
+	}
+	bool pluginLoadStateStreaming(HostedPlugin *plugin) {
+		return plugin->loadStateStreaming();
+	}
 
 	uint32_t pluginProcess(HostedPlugin *plugin, uint32_t blockLength) {
 		return plugin->process(blockLength);
 	}
+	// Input `bytes` are planar float32 audio (`inputChannels` x `inputLength`), followed by packed events with absolute times
+	void pluginRenderOffline(HostedPlugin *plugin, Bytes *bytes, uint32_t inputChannels, uint32_t inputLength, uint32_t maxTailFrames) {
+		size_t audioBytes = size_t(inputChannels)*inputLength*sizeof(float);
+		if (bytes->buffer.size() < audioBytes) {
+			bytes->write().addNull();
+			return;
+		}
+		std::vector<const float *> inputs(inputChannels);
+		for (uint32_t c = 0; c < inputChannels; ++c) {
+			inputs[c] = (const float *)(bytes->buffer.data()) + size_t(c)*inputLength;
+		}
+		OfflineRender render(*plugin);
+		auto result = render.renderPlanar(inputs.data(), inputChannels, inputLength, bytes->buffer.data() + audioBytes, bytes->buffer.size() - audioBytes, maxTailFrames);
+
+		auto cbor = bytes->write();
+		cbor.openMap(7);
+		cbor.addUtf8("status");
+		cbor.addInt(result.status);
+		cbor.addUtf8("frames");
+		cbor.addInt(result.frames);
+		cbor.addUtf8("droppedEvents");
+		cbor.addInt(result.droppedEvents);
+		cbor.addUtf8("seconds");
+		cbor.addFloat(result.seconds);
+		cbor.addUtf8("realtime");
+		cbor.addFloat(result.realtimeFactor);
+		cbor.addUtf8("outputs");
+		cbor.openArray(result.outputs.size());
+		for (auto &output : result.outputs) {
+			cbor.addBytes(output.data(), output.size()*sizeof(float));
+		}
+		cbor.addUtf8("events");
+		cbor.addBytes(result.outputEvents.data(), result.outputEvents.size());
+	}
+
+	PluginGraph * createGraph(HostedWclap *hosted) {
+		return new PluginGraph(*hosted);
+	}
+	void destroyGraph(PluginGraph *graph) {
+		delete graph;
+	}
+	int32_t graphAddPlugin(PluginGraph *graph, HostedPlugin *plugin) {
+		return graph->addPlugin(plugin);
+	}
+	bool graphConnectAudio(PluginGraph *graph, uint32_t fromNode, uint32_t fromPort, uint32_t toNode, uint32_t toPort) {
+		return graph->connectAudio(fromNode, fromPort, toNode, toPort);
+	}
+	bool graphConnectEvents(PluginGraph *graph, uint32_t fromNode, uint32_t toNode) {
+		return graph->connectEvents(fromNode, toNode);
+	}
+	void graphSetThreads(PluginGraph *graph, uint32_t threadCount, double deadlineSeconds) {
+		graph->setThreads(threadCount, deadlineSeconds);
+	}
+	bool graphCompile(PluginGraph *graph, uint32_t maxFrames) {
+		return graph->compile(maxFrames);
+	}
+	uint32_t graphProcess(PluginGraph *graph, uint32_t blockLength) {
+		return graph->process(blockLength);
+	}
 }
@@ -1,22 +1,42 @@
 #pragma once
 
 #include "./common.h"
+#include "./arena-accounting.h"
+#include "./background-worker.h"
+#include "./event-queue.h"
+#include "./param-tracker.h"
+#include "./plugin-stream.h"
+#include "./resource-cache.h"
+#include "./state-snapshots.h"
 
-#include <algorithm> // we need stable_sort
+#include <algorithm> // we need std::merge
+#include <array>
 #include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
 
-__attribute__((import_module("env"), import_name("eventsOutTryPush")))
+WCLAP_HOST_IMPORT("eventsOutTryPush")
 extern bool pluginOutputEventsTryPush32(const void *plugin, uint32_t remotePtr, uint32_t length);
-__attribute__((import_module("env"), import_name("webviewSend")))
+WCLAP_HOST_IMPORT("webviewSend")
 extern bool pluginWebviewSend(const void *plugin, uint32_t remotePtr, uint32_t length);
-__attribute__((import_module("env"), import_name("stateMarkDirty")))
+WCLAP_HOST_IMPORT("stateMarkDirty")
 extern bool pluginStateMarkDirty(const void *plugin);
-__attribute__((import_module("env"), import_name("paramsRescan")))
+WCLAP_HOST_IMPORT("paramsRescan")
 extern bool pluginParamsRescan(const void *plugin, uint32_t flags);
 
 namespace impl32 {
 using namespace wclap32;
 
+struct PluginGraph;
+
 // A WCLAP plugin and its host
 struct HostedPlugin {
 	uint32_t pluginIndex = uint32_t(-1);
@@ -30,12 +50,23 @@ struct HostedPlugin {
 	ArenaPtr audioThreadArena;
 	Arena::Scoped audioThreadScope;
 	ArenaPool &arenaPool;
+	// Shared with the other plugins from the same module
+	PluginStreamPool *streamPool = nullptr;
+	BackgroundWorker *stateWorker = nullptr;
+	// CLAP's main-thread calls must never overlap, but ours come from the JS thread and from `stateWorker` - the plugin's own callbacks can re-enter
+	std::recursive_mutex mainThreadMutex;
+	std::unique_lock<std::recursive_mutex> lockMainThread() {
+		return std::unique_lock<std::recursive_mutex>{mainThreadMutex};
+	}
+	ArenaAccounting &arenaAccounting;
+	// What this plugin has placed in the arenas it keeps (see `getMemoryStats()`)
+	struct ArenaBytes {
+		uint64_t host = 0, layout = 0, layoutHighWater = 0, message = 0;
+	} arenaBytes;
 		
 	Pointer<const wclap_plugin> pluginPtr;
 	Pointer<const wclap_input_events> inputEventsPtr;
 	Pointer<const wclap_output_events> outputEventsPtr;
-	Pointer<const wclap_istream> istreamPtr;
-	Pointer<const wclap_ostream> ostreamPtr;
 	wclap_plugin wclapPlugin;
 	Pointer<const wclap_plugin_audio_ports> audioPortsExtPtr;
 	Pointer<const wclap_plugin_gui> guiExtPtr;
@@ -48,113 +79,363 @@ struct HostedPlugin {
 	
 	// When active, this points to a struct in the Instance's memory, including buffers which the JS-side host knows how to fill out
 	Pointer<wclap_process> processStructPtr;
+	// Every channel's entry in a `.data32` array, and the buffer it points to
+	struct AudioChannel {
+		Pointer<Pointer<float>> data32;
+		uint32_t index;
+		Pointer<float> buffer; // currently bound - either our own, or one provided by the caller
+		Pointer<float> ownBuffer;
+	};
+	std::vector<AudioChannel> audioChannels;
+	struct AudioPort {
+		wclap_id id, inPlacePair;
+		uint32_t firstChannel, channelCount; // in `audioChannels`
+	};
+	std::vector<AudioPort> inputPorts, outputPorts;
 	
-	// TODO: lock-free queue to let us `addEvent32` safely
-	std::recursive_mutex pendingEventsMutex;
+	// Events arrive through a lock-free queue, so the audio thread never waits on producers
+	EventQueue eventQueue;
+	std::mutex eventProducerMutex; // only needed if there are several producer threads - never taken by the consumer
+	// Events taken from the queue but held back by `paramsFlush()` or for a later block (only touched by the processing/flushing thread).  At most `heldEventBytes()`: beyond that they're dropped and counted, rather than allocated for.
 	std::vector<unsigned char> pendingEventBytes;
 	std::vector<size_t> pendingEventStarts;
+	// Events for the current block, packed contiguously (with `EventQueue::alignment`) so they cross into the Instance in a single copy
+	std::vector<unsigned char> stagedEventBytes;
 	struct CopiedEvent {
 		uint32_t time;
+		uint32_t offset; // in `stagedEventBytes`
 		Pointer<wclap_event_header> pointer;
 	};
-	std::vector<CopiedEvent> copiedInputEventPtrs;
-	void addEvent32(const wclap_event_header *event) {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
+	std::vector<CopiedEvent> copiedInputEventPtrs, copiedEventsScratch;
+	bool copiedEventsOrdered = true;
+	// Counts the copies into the Instance, for the most recent block and in total
+	struct EventTransferStats {
+		std::atomic<uint32_t> blockEvents{0}, blockBytes{0}, blockCalls{0};
+		std::atomic<uint64_t> blocks{0}, totalEvents{0}, totalBytes{0}, totalCalls{0};
+		std::atomic<uint64_t> scratchOverflows{0}, scratchDropped{0}; // blocks with more events than `audioScratch` holds, and the events left out
+		std::atomic<uint64_t> heldDropped{0}; // events which were due later, but didn't fit in `heldEventBytes()`
+		std::atomic<uint64_t> rampsDropped{0}; // ramps which arrived while every slot in `paramRamps` was busy
+		std::atomic<uint64_t> outputDropped{0}; // output events from a split block, too big for `outputEventScratch`
+	} eventTransferStats;
+	// Fixed-size region for each block's events, reserved (with the audio layout) in `start()`.  Every block starts again from the beginning, so the audio thread never takes anything from an arena.
+	struct AudioScratch {
+		Pointer<unsigned char> base;
+		uint32_t capacity = 0;
+	} audioScratch;
+	// While processing a split block, output event times are relative to the sub-block: this is added back, via a copy in `outputEventScratch`
+	uint32_t outputTimeOffset = 0;
+	static constexpr uint32_t outputEventScratchBytes = 512;
+	Pointer<unsigned char> outputEventScratch;
+	// How many bytes of events a block can take (and how many can be held back for later blocks) - typically much less than a full `eventQueue`, with anything beyond it dropped and counted
+	static constexpr uint32_t defaultEventBudgetBytes = 16384;
+	uint32_t eventBudgetBytes = defaultEventBudgetBytes;
+	uint32_t heldEventBytes() const {
+		return eventBudgetBytes;
+	}
+	uint32_t audioScratchBytes() const {
+		return eventBudgetBytes;
+	}
+	// Only while stopped: the scratch is part of the audio layout, which is rebuilt on the next `start()`
+	bool setEventBudget(uint32_t bytes) {
+		auto lock = lockMainThread();
+		if (activated) return false;
+		eventBudgetBytes = bytes;
+		reserveEventBuffers();
+		audioLayoutStale = true;
+		return true;
+	}
+	// Enough that a block's worth of events (and the held ones) never allocates: every event is at least a header
+	void reserveEventBuffers() {
+		pendingEventBytes.shrink_to_fit();
+		pendingEventBytes.reserve(heldEventBytes());
+		pendingEventStarts.shrink_to_fit();
+		pendingEventStarts.reserve(heldEventBytes()/sizeof(wclap_event_header));
+		stagedEventBytes.shrink_to_fit();
+		stagedEventBytes.reserve(audioScratchBytes());
+		for (auto *list : {&copiedInputEventPtrs, &copiedEventsScratch}) {
+			list->shrink_to_fit();
+			list->reserve(audioScratchBytes()/sizeof(wclap_event_header));
+		}
+	}
+	// Events in this space are instructions for the host itself, and are never passed to the plugin
+	static constexpr uint16_t hostEventSpaceId = 0x7FFF;
+	enum {HOST_EVENT_PARAM_RAMP};
+	struct HostParamRampEvent {
+		wclap_event_header header; // `.time` is when the ramp starts
+		wclap_id paramId;
+		uint32_t flags;
+		uint32_t duration;
+		double from, to;
+	};
+	enum {RAMP_IS_MOD = 1, RAMP_EXPONENTIAL = 2};
+	// Active ramps, which generate timed events each block (fixed size, so no allocation when scheduling)
+	struct ParamRamp {
+		bool active = false;
+		wclap_id paramId;
+		uint32_t flags;
+		uint32_t duration;
+		double from, to;
+		int64_t time; // ramp-relative time at the start of the next block (negative before the ramp starts)
+		
+		double valueAt(uint32_t position) const {
+			double ratio = duration ? double(position)/duration : 1;
+			if ((flags&RAMP_EXPONENTIAL) && from*to > 0) {
+				return from*std::pow(to/from, ratio);
+			}
+			return from + (to - from)*ratio;
+		}
+	};
+	std::array<ParamRamp, 64> paramRamps;
+	uint32_t rampStepFrames = 16;
+	// Optionally split `process()` at ramp breakpoints, for plugins which don't smooth/interpolate parameters
+	bool splitAtRampPoints = false;
+	std::array<uint32_t, 256> splitPoints;
+	size_t splitPointCount = 0;
+	// The part of `copiedInputEventPtrs` visible to the plugin (smaller than the whole list when splitting)
+	size_t visibleEventsBegin = 0, visibleEventsEnd = 0;
+
+	bool addEvent32(const wclap_event_header *event) {
+		std::lock_guard<std::mutex> lock{eventProducerMutex};
+		return eventQueue.push(event);
+	}
+	// Events which can be passed from one plugin to another.
+	// As the host, it's our job to only pass through appropriate events - in particular, only events which require no 32/64 translation, or effect-specific IDs / cookie pointers.
+	static bool isRoutableEvent(const wclap_event_header *event) {
+		return event->type == WCLAP_EVENT_NOTE_ON || event->type == WCLAP_EVENT_NOTE_OFF || event->type == WCLAP_EVENT_NOTE_CHOKE || event->type == WCLAP_EVENT_MIDI || event->type == WCLAP_EVENT_MIDI_SYSEX || event->type == WCLAP_EVENT_MIDI2;
+	}
+	bool acceptEvent(const void *ptr) {
+		// These are events coming from other plugins
+		auto *event = (const wclap_event_header *)ptr;
+		return isRoutableEvent(event) && addEvent32(event);
+	}
+	static bool hasParamCookie(const wclap_event_header *event) {
+		return event->space_id == WCLAP_CORE_EVENT_SPACE_ID && (event->type == WCLAP_EVENT_PARAM_VALUE || event->type == WCLAP_EVENT_PARAM_MOD) && event->size == sizeof(wclap_event_param_value);
+	}
+	static bool isParamEvent(const wclap_event_header *event) {
+		return event->type == WCLAP_EVENT_PARAM_VALUE || event->type == WCLAP_EVENT_PARAM_MOD || event->type == WCLAP_EVENT_PARAM_GESTURE_BEGIN || event->type == WCLAP_EVENT_PARAM_GESTURE_END;
+	}
+	bool holdEvent(const wclap_event_header *event) {
 		auto index = pendingEventBytes.size();
 		while (index%alignof(wclap_event_header)) ++index;
+		if (index + event->size > heldEventBytes()) {
+			eventTransferStats.heldDropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
 		
 		pendingEventStarts.push_back(index);
 		pendingEventBytes.resize(index + event->size);
 		std::memcpy(pendingEventBytes.data() + index, event, event->size);
+		return true;
 	}
-	bool acceptEvent(const void *ptr) {
-		// These are events coming from other plugins.
-		// As the host, it's our job to only pass through appropriate events - in particular, only events which require no 32/64 translation, or effect-specific IDs / cookie pointers.
-		auto *event = (const wclap_event_header *)ptr;
-		if (event->type == WCLAP_EVENT_NOTE_ON || event->type == WCLAP_EVENT_NOTE_OFF || event->type == WCLAP_EVENT_NOTE_CHOKE || event->type == WCLAP_EVENT_MIDI || event->type == WCLAP_EVENT_MIDI_SYSEX || event->type == WCLAP_EVENT_MIDI2) {
-			addEvent32(event);
-			return true;
+	// Staging is bounded by `audioScratchBytes()` (all reserved up front, so it never allocates): beyond that, events are dropped and counted when the block is transferred
+	uint32_t stagedDropped = 0;
+	void stageEvent(const wclap_event_header *event) {
+		auto offset = stagedEventBytes.size();
+		while (offset%EventQueue::alignment) ++offset;
+		if (offset + event->size > audioScratchBytes()) {
+			++stagedDropped;
+			return;
 		}
-		return false;
+		stagedEventBytes.resize(offset + event->size);
+		std::memcpy(stagedEventBytes.data() + offset, event, event->size);
+
+		if (!copiedInputEventPtrs.empty() && event->time < copiedInputEventPtrs.back().time) {
+			copiedEventsOrdered = false;
+		}
+		copiedInputEventPtrs.push_back(CopiedEvent{event->time, uint32_t(offset), {0}});
 	}
-	wclap_event_header * getEvent(size_t pendingIndex) {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		size_t start = pendingEventStarts[pendingIndex];
-		return (wclap_event_header *)(pendingEventBytes.data() + start);
+	// Copy all the staged events across in one go (to `basePtr`), and fill in their remote pointers.
+	// Events which don't fit in `capacity` bytes are left out.
+	void transferCopiedEvents(Pointer<unsigned char> basePtr, uint32_t capacity) {
+		auto &stats = eventTransferStats;
+		uint32_t bytes = uint32_t(stagedEventBytes.size()), calls = 0;
+		uint64_t dropped = stagedDropped;
+		stagedDropped = 0;
+		if (bytes > capacity) {
+			auto end = std::remove_if(copiedInputEventPtrs.begin(), copiedInputEventPtrs.end(), [&](const CopiedEvent &copied){
+				auto *event = (const wclap_event_header *)(stagedEventBytes.data() + copied.offset);
+				return copied.offset + event->size > capacity;
+			});
+			dropped += copiedInputEventPtrs.end() - end;
+			copiedInputEventPtrs.erase(end, copiedInputEventPtrs.end());
+			bytes = capacity;
+		}
+		if (dropped) {
+			stats.scratchOverflows.fetch_add(1, std::memory_order_relaxed);
+			stats.scratchDropped.fetch_add(dropped, std::memory_order_relaxed);
+		}
+		if (bytes) {
+			instance->setArray(basePtr, stagedEventBytes.data(), bytes);
+			calls = 1;
+			for (auto &copied : copiedInputEventPtrs) {
+				auto eventPtr = basePtr;
+				eventPtr += copied.offset;
+				copied.pointer = eventPtr.cast<wclap_event_header>();
+			}
+		}
+		visibleEventsBegin = 0;
+		visibleEventsEnd = copiedInputEventPtrs.size();
+
+		stats.blockEvents.store(uint32_t(copiedInputEventPtrs.size()), std::memory_order_relaxed);
+		stats.blockBytes.store(bytes, std::memory_order_relaxed);
+		stats.blockCalls.store(calls, std::memory_order_relaxed);
+		stats.blocks.fetch_add(1, std::memory_order_relaxed);
+		stats.totalEvents.fetch_add(copiedInputEventPtrs.size(), std::memory_order_relaxed);
+		stats.totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+		stats.totalCalls.fetch_add(calls, std::memory_order_relaxed);
 	}
-	void copyEvent(Arena::Scoped &scoped, size_t pendingIndex) {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		auto *event = getEvent(pendingIndex);
-		
-		// Copy bytes across, store remote pointer
-		auto eventPtr = scoped.reserve(event->size, alignof(wclap_event_header));
-		instance->setArray(eventPtr.cast<unsigned char>(), (unsigned char *)event, event->size);
-		copiedInputEventPtrs.push_back(CopiedEvent{event->time, eventPtr.cast<wclap_event_header>()});
-		
-		// Remove start from the list
-		pendingEventStarts.erase(pendingEventStarts.begin() + pendingIndex);
-		if (pendingEventStarts.empty()) {
-			// If this was the last event, clear the pending bytes as well
-			pendingEventBytes.clear();
+	// Single pass over the held events and the queue: stages events matching `filter` for the plugin, holds on to the rest
+	template<class Filter>
+	void stageEvents(Filter &&filter) {
+		// Events queued or held before a `RESCAN_ALL` have cookies the plugin may have freed
+		bool staleCookies = paramCookiesStale.exchange(false, std::memory_order_acquire);
+		wclap_event_param_value withoutCookie;
+		auto checkCookie = [&](const wclap_event_header *event) {
+			if (!staleCookies || !hasParamCookie(event)) return event;
+			std::memcpy(&withoutCookie, event, sizeof(withoutCookie));
+			withoutCookie.cookie = {0};
+			return (const wclap_event_header *)&withoutCookie.header;
+		};
+
+		// Compact the held events towards the start, so the write position never overtakes the read position
+		size_t heldCount = pendingEventStarts.size(), keptCount = 0, keptEnd = 0;
+		for (size_t i = 0; i < heldCount; ++i) {
+			auto *event = (wclap_event_header *)(pendingEventBytes.data() + pendingEventStarts[i]);
+			if (staleCookies && hasParamCookie(event)) ((wclap_event_param_value *)event)->cookie = {0};
+			if (filter(event)) {
+				stageEvent(event);
+			} else {
+				auto index = keptEnd;
+				while (index%alignof(wclap_event_header)) ++index;
+				std::memmove(pendingEventBytes.data() + index, event, event->size);
+				pendingEventStarts[keptCount++] = index;
+				keptEnd = index + event->size;
+			}
+		}
+		pendingEventStarts.resize(keptCount);
+		pendingEventBytes.resize(keptEnd);
+
+		eventQueue.drain([&](const wclap_event_header *event){
+			event = checkCookie(event);
+			if (event->space_id == hostEventSpaceId) {
+				hostEvent(event);
+			} else if (filter(event)) {
+				stageEvent(event);
+			} else {
+				holdEvent(event);
+			}
+		});
+		for (auto *source : eventSources) {
+			source->drain([&](const wclap_event_header *event){
+				if (filter(event)) {
+					stageEvent(event);
+				} else {
+					holdEvent(event);
+				}
+			});
+		}
+	}
+	void hostEvent(const wclap_event_header *event) {
+		if (event->type == HOST_EVENT_PARAM_RAMP && event->size >= sizeof(HostParamRampEvent)) {
+			HostParamRampEvent rampEvent;
+			std::memcpy(&rampEvent, event, sizeof(rampEvent));
+			for (auto &ramp : paramRamps) {
+				// Replace any existing ramp for the same parameter, otherwise take the first free slot
+				if (ramp.active && (ramp.paramId != rampEvent.paramId || (ramp.flags&RAMP_IS_MOD) != (rampEvent.flags&RAMP_IS_MOD))) continue;
+				ramp = {true, rampEvent.paramId, rampEvent.flags, rampEvent.duration, rampEvent.from, rampEvent.to, -int64_t(event->time)};
+				return;
+			}
+			eventTransferStats.rampsDropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	// Generates timed parameter events for the active ramps, and notes the breakpoints in case we're splitting the block
+	void stageRampEvents(uint32_t blockLength) {
+		splitPointCount = 0;
+		for (auto &ramp : paramRamps) {
+			if (!ramp.active) continue;
+			int64_t position = std::max<int64_t>(ramp.time, 0);
+			position = std::min<int64_t>((position + rampStepFrames - 1)/rampStepFrames*rampStepFrames, ramp.duration);
+			while (position - ramp.time < blockLength) {
+				uint32_t eventTime = uint32_t(position - ramp.time);
+				stageParamEvent(ramp.paramId, ramp.valueAt(uint32_t(position)), eventTime, ramp.flags&RAMP_IS_MOD);
+				if (eventTime > 0 && splitPointCount < splitPoints.size()) {
+					splitPoints[splitPointCount++] = eventTime;
+				}
+				if (position >= ramp.duration) {
+					ramp.active = false;
+					break;
+				}
+				position = std::min<int64_t>(position + rampStepFrames, ramp.duration);
+			}
+			ramp.time += blockLength;
 		}
+		std::sort(splitPoints.begin(), splitPoints.begin() + splitPointCount);
+		splitPointCount = std::unique(splitPoints.begin(), splitPoints.begin() + splitPointCount) - splitPoints.begin();
 	}
+	// Stable ordering by time, which only does work if events arrived out of order
 	void sortCopiedEvents() {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		std::stable_sort(copiedInputEventPtrs.begin(), copiedInputEventPtrs.end(), [](const CopiedEvent &a, const CopiedEvent &b){
+		if (copiedEventsOrdered) return;
+		auto byTime = [](const CopiedEvent &a, const CopiedEvent &b){
 			return a.time < b.time;
-		});
+		};
+		// Events arrive as a few ascending runs (one per source), so merge adjacent runs until there's only one
+		size_t count = copiedInputEventPtrs.size();
+		copiedEventsScratch.resize(count);
+		while (true) {
+			auto *events = copiedInputEventPtrs.data(), *scratch = copiedEventsScratch.data();
+			size_t runCount = 0;
+			size_t start = 0;
+			while (start < count) {
+				size_t mid = start + 1;
+				while (mid < count && !byTime(events[mid], events[mid - 1])) ++mid;
+				size_t end = mid;
+				while (end < count && (end == mid || !byTime(events[end], events[end - 1]))) ++end;
+				std::merge(events + start, events + mid, events + mid, events + end, scratch + start, byTime);
+				start = end;
+				++runCount;
+			}
+			std::swap(copiedInputEventPtrs, copiedEventsScratch); // swaps the buffers, doesn't allocate
+			if (runCount <= 1) break;
+		}
+		copiedEventsOrdered = true;
 	}
-	void clearEvents() {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		pendingEventStarts.clear();
-		pendingEventBytes.clear();
+	void clearCopiedEvents() {
+		stagedEventBytes.clear();
+		stagedDropped = 0;
 		copiedInputEventPtrs.clear();
+		copiedEventsOrdered = true;
+		visibleEventsBegin = visibleEventsEnd = 0;
 	}
 	
-	std::recursive_mutex streamMutex;
-	size_t streamPos = 0;
-	std::vector<unsigned char> streamData;
-	void clearStreamAlreadyLocked() {
-		streamPos = 0;
-		streamData.resize(0);
-	}
-	int64_t istreamRead(Pointer<void> ptr, uint64_t length) {
-		auto scoped = arenaPool.scoped();
-		if (streamPos >= streamData.size()) return 0;
-		if (streamPos + length > streamData.size()) {
-			length = streamData.size() - streamPos;
-		}
-		instance->setArray(ptr.cast<unsigned char>(), streamData.data() + streamPos, length);
-		streamPos += length;
-		return length;
-	}
-	int64_t ostreamWrite(Pointer<const void> ptr, uint64_t length) {
-		auto start = streamData.size();
-		streamData.resize(start + length);
-		instance->getArray(ptr.cast<const unsigned char>(), streamData.data() + start, uint32_t(length));
-		return length;
-	}
-
 	template<class FnPtr, class... Args>
 	auto callPlugin(FnPtr fn, Args... args) {
 		return instance->call(fn, pluginPtr, args...);
 	}
 
-	HostedPlugin(Pointer<const wclap_plugin> pluginPtr, Instance *instance, ArenaPtr arena) : pluginPtr(pluginPtr), instance(instance), audioThreadArena(std::move(arena)), audioThreadScope(audioThreadArena->scoped()), arenaPool(audioThreadArena->pool) {
-		pendingEventBytes.reserve(8192);
-		pendingEventStarts.reserve(512);
-		copiedInputEventPtrs.reserve(512);
-		streamData.reserve(8192);
+	HostedPlugin(Pointer<const wclap_plugin> pluginPtr, Instance *instance, ArenaPtr arena, ArenaAccounting &arenaAccounting) : pluginPtr(pluginPtr), instance(instance), audioThreadArena(std::move(arena)), audioThreadScope(audioThreadArena->scoped()), arenaPool(audioThreadArena->pool), arenaAccounting(arenaAccounting) {
+		reserveEventBuffers();
 	}
 	~HostedPlugin() {
+		{
+			// Background jobs refer to this plugin, so wait for them
+			std::unique_lock<std::mutex> lock{stateJobsMutex};
+			stateJobsDone.wait(lock, [this](){return !pendingStateJobs;});
+		}
 		if (pluginPtr) {
+			auto lock = lockMainThread();
 			callPlugin(pluginPtr[&wclap_plugin::destroy]);
 		}
+		if (messageArena) {
+			arenaPool.returnToPool(messageArena);
+			arenaAccounting.release(ArenaAccounting::KEPT_MESSAGE, arenaBytes.message);
+		}
 		arenaPool.returnToPool(audioThreadArena);
+		arenaAccounting.release(ArenaAccounting::KEPT_PLUGIN, arenaBytes.host + arenaBytes.layout);
 	}
 
 	void init() {
-		auto scoped = arenaPool.scoped();
+		auto lock = lockMainThread();
+		auto scoped = arenaAccounting.temp(arenaPool);
 		auto plugin = instance->get(pluginPtr);
 		callPlugin(plugin.init);
 		audioPortsExtPtr = callPlugin(plugin.get_extension, scoped.writeString("clap.audio-ports")).cast<wclap_plugin_audio_ports>();
@@ -165,9 +446,13 @@ struct HostedPlugin {
 		stateExtPtr = callPlugin(plugin.get_extension, scoped.writeString("clap.state")).cast<wclap_plugin_state>();
 		tailExtPtr = callPlugin(plugin.get_extension, scoped.writeString("clap.tail")).cast<wclap_plugin_tail>();
 		webviewExtPtr = callPlugin(plugin.get_extension, scoped.writeString("clap.webview/3")).cast<wclap_plugin_webview>();
+		rebuildParamInfo();
 	}
 	
 	void mainThread() {
+		// If the state worker is busy with the plugin, leave the request for next time
+		std::unique_lock<std::recursive_mutex> lock{mainThreadMutex, std::try_to_lock};
+		if (!lock.owns_lock()) return;
 		// Only call if requested
 		if (!mainThreadCallbackDone.test_and_set()) {
 			callPlugin(pluginPtr[&wclap_plugin::on_main_thread]);
@@ -175,8 +460,9 @@ struct HostedPlugin {
 	}
 	
 	void getInfo(CborWriter &cbor) {
+		auto lock = lockMainThread();
 		auto plugin = instance->get(pluginPtr);
-		auto scoped = arenaPool.scoped();
+		auto scoped = arenaAccounting.temp(arenaPool);
 		cbor.openMap();
 
 		cbor.addUtf8("desc");
@@ -200,18 +486,20 @@ struct HostedPlugin {
 
 		cbor.close();
 	}
-	void setParam(wclap_id paramId, double value) {
-		wclap_event_param_value event{
+	wclap_event_param_value makeParamEvent(wclap_id paramId, double value, uint32_t time, bool isMod) {
+		// `wclap_event_param_mod` has the same layout, with `.amount` in place of `.value`
+		static_assert(sizeof(wclap_event_param_mod) == sizeof(wclap_event_param_value), "PARAM_MOD/PARAM_VALUE layouts differ");
+		return {
 			.header={
 				.size=sizeof(wclap_event_param_value),
-				.time=0,
+				.time=time,
 				.space_id=WCLAP_CORE_EVENT_SPACE_ID,
-				.type=WCLAP_EVENT_PARAM_VALUE,
+				.type=uint16_t(isMod ? WCLAP_EVENT_PARAM_MOD : WCLAP_EVENT_PARAM_VALUE),
 				.flags=WCLAP_EVENT_IS_LIVE
 			},
 			.param_id=paramId,
-			// Plugin will have to look it up by event ID
-			.cookie={0},
+			// Saves the plugin looking it up by ID (null if we don't know it yet)
+			.cookie=paramTracker.cookie(paramId),
 			// not note-specific
 			.note_id=-1,
 			.port_index=-1,
@@ -219,82 +507,327 @@ struct HostedPlugin {
 			.key=-1,
 			.value=value
 		};
-		addEvent32(&event.header);
 	}
+	// Audio thread only (used for ramps)
+	void stageParamEvent(wclap_id paramId, double value, uint32_t time, bool isMod) {
+		auto event = makeParamEvent(paramId, value, time, isMod);
+		stageEvent(&event.header);
+	}
+	// `time` is a frame offset from the start of the next block
+	// The producer lock also keeps the tracker still while we look up the cookie (see `rebuildParamInfo()`)
+	bool setParam(wclap_id paramId, double value, uint32_t time=0) {
+		std::lock_guard<std::mutex> lock{eventProducerMutex};
+		auto event = makeParamEvent(paramId, value, time, false);
+		if (!eventQueue.push(&event.header)) return false;
+		setCachedParamValue(paramId, value);
+		return true;
+	}
+	bool modParam(wclap_id paramId, double amount, uint32_t time=0) {
+		std::lock_guard<std::mutex> lock{eventProducerMutex};
+		auto event = makeParamEvent(paramId, amount, time, true);
+		return eventQueue.push(&event.header);
+	}
+	// Ramps from `from` to `to` over `duration` frames, starting `time` frames into the next block
+	bool rampParam(wclap_id paramId, double from, double to, uint32_t time, uint32_t duration, uint32_t flags) {
+		HostParamRampEvent event{
+			.header={
+				.size=sizeof(HostParamRampEvent),
+				.time=time,
+				.space_id=hostEventSpaceId,
+				.type=HOST_EVENT_PARAM_RAMP,
+				.flags=0
+			},
+			.paramId=paramId,
+			.flags=flags,
+			.duration=duration,
+			.from=from,
+			.to=to
+		};
+		std::lock_guard<std::mutex> lock{eventProducerMutex};
+		if (!eventQueue.push(&event.header)) return false;
+		if (!(flags&RAMP_IS_MOD)) setCachedParamValue(paramId, to);
+		return true;
+	}
+	void setRampOptions(uint32_t stepFrames, bool splitBlocks) {
+		rampStepFrames = std::max<uint32_t>(stepFrames, 1);
+		splitAtRampPoints = splitBlocks;
+	}
+	// Parameter info, so that listing parameters doesn't need several plugin calls per parameter
+	struct CachedParam {
+		wclap_id id;
+		uint32_t flags;
+		Pointer<void> cookie;
+		double min, max, defaultValue;
+		std::string name, module;
+		// Formatted on demand, and kept until the value changes
+		bool hasText = false;
+		double textValue = 0;
+		std::string text;
+	};
+	// Only used from the thread which calls `getParams()` (the AudioWorklet's JS thread)
+	std::vector<CachedParam> paramCache;
+	// Values (in the same order as `paramCache`), which the plugin's output events update from the audio thread
+	ParamTracker paramTracker;
+	// Set by `paramsRescan()` (or a state load), and picked up by the next read
+	std::atomic<bool> paramValuesStale{true};
+	// Set by `paramsRescan()` (which is a callback from the plugin, so a bad time to call back into it), and picked up by the next read
+	std::atomic<bool> paramInfoStale{false};
+	// The IDs changed while the plugin was active (which it shouldn't do), so the tracker is replaced once it's stopped
+	bool paramTrackerResetPending = false;
+	// Set by `RESCAN_ALL`, and picked up by the event consumer, which clears the cookies in events it already has
+	std::atomic<bool> paramCookiesStale{false};
+
+	// Reads the parameter list, from `init()` and the first read after `paramsRescan()`.  The IDs can only change with `RESCAN_ALL`, when the plugin must be deactivated - so the audio thread isn't using the tracker, and producers are held off by `eventProducerMutex` while it's replaced.
+	void rebuildParamInfo() {
+		if (!paramsExtPtr) return;
+		auto lock = lockMainThread();
+		paramInfoStale = false;
+		auto scoped = arenaAccounting.temp(arenaPool);
+		auto paramsExt = instance->get(paramsExtPtr);
+		std::vector<CachedParam> infos;
+
+		wclap_param_info info;
+		auto infoPtr = scoped.copyAcross(info);
+		auto count = callPlugin(paramsExt.count);
+		infos.reserve(count);
+		std::vector<wclap_id> ids;
+		for (uint32_t i = 0; i < count; ++i) {
+			if (!callPlugin(paramsExt.get_info, i, infoPtr)) continue;
+			info = instance->get(infoPtr);
+			info.name[255] = 0; // ensure null-terminated
+			info.module[1023] = 0;
+			ids.push_back(info.id);
+			infos.push_back(CachedParam{
+				.id=info.id,
+				.flags=info.flags,
+				.cookie=info.cookie,
+				.min=info.min_value,
+				.max=info.max_value,
+				.defaultValue=info.default_value,
+				.name=info.name,
+				.module=info.module
+			});
+		}
+		std::lock_guard<std::mutex> producerLock{eventProducerMutex};
+		if (!paramTracker.hasIds(ids)) {
+			if (activated) {
+				// Keep the old list (which matches the tracker) until `stop()`
+				paramTrackerResetPending = true;
+				return;
+			}
+			paramTracker.reset(ids);
+		}
+		paramCache = std::move(infos);
+		for (uint32_t i = 0; i < paramCache.size(); ++i) {
+			paramTracker.setCookie(i, paramCache[i].cookie);
+		}
+		paramValuesStale = true;
+	}
+	void refreshParamCache() {
+		if (!paramsExtPtr) return;
+		auto lock = lockMainThread();
+		if (paramInfoStale && !paramTrackerResetPending) rebuildParamInfo();
+		if (!paramValuesStale.exchange(false)) return;
+
+		auto scoped = arenaAccounting.temp(arenaPool);
+		auto paramsExt = instance->get(paramsExtPtr);
+		auto valuePtr = scoped.copyAcross(double(0));
+		for (uint32_t i = 0; i < paramCache.size(); ++i) {
+			if (callPlugin(paramsExt.get_value, paramCache[i].id, valuePtr)) {
+				paramTracker.store(i, instance->get(valuePtr));
+			}
+		}
+	}
+	void setCachedParamValue(wclap_id paramId, double value) {
+		auto index = paramTracker.indexOf(paramId);
+		if (index >= 0) paramTracker.store(index, value);
+	}
+	// Calls `value_to_text()` only if the value has changed since the last time
+	bool cachedParamText(uint32_t index) {
+		auto &param = paramCache[index];
+		double value = paramTracker.value(index);
+		if (param.hasText && param.textValue == value) return true;
+		auto scoped = arenaAccounting.temp(arenaPool);
+		auto textPtr = scoped.array<char>(256);
+		param.hasText = callPlugin(paramsExtPtr[&wclap_plugin_params::value_to_text], param.id, value, textPtr, 255);
+		param.textValue = value;
+		if (param.hasText) {
+			char text[256] = {};
+			instance->getArray(textPtr, text, 255);
+			param.text = text;
+		}
+		return param.hasText;
+	}
+
 	void getParam(wclap_id paramId, CborWriter &cbor) {
-		auto scoped = arenaPool.scoped();
 		if (!paramsExtPtr) { // how would this even happen?
 			cbor.addNull();
 			return;
 		}
-
-		double value = 0;
-		auto valuePtr = scoped.copyAcross(value);
-
-		if (!callPlugin(paramsExtPtr[&wclap_plugin_params::get_value], paramId, valuePtr)) {
-			cbor.addUtf8("plugin_params.get_value() returned false");
+		auto lock = lockMainThread();
+		refreshParamCache();
+		auto index = paramTracker.indexOf(paramId);
+		if (index < 0) {
+			cbor.addUtf8("unknown parameter ID");
 			return;
 		}
-		value = instance->get(valuePtr);
-		auto textPtr = scoped.array<char>(255);
-		bool hasText = callPlugin(paramsExtPtr[&wclap_plugin_params::value_to_text], paramId, value, textPtr, 255);
 
 		cbor.openMap();
 		cbor.addUtf8("value");
-		cbor.addFloat(value);
-		if (hasText) {
-			char text[256] = {};
-			instance->getArray(textPtr, text, 255);
+		cbor.addFloat(paramTracker.value(index));
+		if (cachedParamText(index)) {
 			cbor.addUtf8("text");
-			cbor.addUtf8(text);
+			cbor.addUtf8(paramCache[index].text);
 		}
 		cbor.close();
 	}
-	void getParams(CborWriter &cbor) {
-		auto scoped = arenaPool.scoped();
-		cbor.openArray();
+	// Fixed layout, so JS can read a single parameter without any decoding
+	struct ParamValueResult {
+		double value;
+		uint32_t flags; // 1 = known parameter, 2 = has text
+		uint32_t textLength;
+		char text[256];
+	};
+	ParamValueResult paramValueResult;
+	const ParamValueResult * getParamValue(wclap_id paramId, bool withText) {
+		auto &result = paramValueResult;
+		result.value = 0;
+		result.flags = result.textLength = 0;
+		if (!paramsExtPtr) return &result;
+		auto lock = lockMainThread();
+		refreshParamCache();
+		auto index = paramTracker.indexOf(paramId);
+		if (index < 0) return &result;
 
-		wclap_param_info info;
-		auto infoPtr = scoped.copyAcross(info);
-		
-		auto paramsExt = instance->get(paramsExtPtr);
-		auto count = callPlugin(paramsExt.count);
+		result.value = paramTracker.value(index);
+		result.flags = 1;
+		if (withText && cachedParamText(index)) {
+			auto &text = paramCache[index].text;
+			result.flags |= 2;
+			result.textLength = uint32_t(std::min(text.size(), sizeof(result.text) - 1));
+			std::memcpy(result.text, text.data(), result.textLength);
+			result.text[result.textLength] = 0;
+		}
+		return &result;
+	}
+	// `count` values followed by `count` IDs (so the values stay 8-byte aligned) - returns how many were queued
+	uint32_t setParams(const unsigned char *data, uint32_t count) {
+		uint32_t queued = 0;
 		for (uint32_t i = 0; i < count; ++i) {
-			if (!callPlugin(paramsExt.get_info, i, infoPtr)) continue;
-			info = instance->get(infoPtr);
+			double value;
+			wclap_id paramId;
+			std::memcpy(&value, data + i*sizeof(double), sizeof(double));
+			std::memcpy(&paramId, data + count*sizeof(double) + i*sizeof(wclap_id), sizeof(wclap_id));
+			if (!setParam(paramId, value)) break; // queue is full
+			++queued;
+		}
+		return queued;
+	}
+	// The whole parameter table (including values) in one go - text is only included if it's already been formatted for the current value
+	void getParams(CborWriter &cbor) {
+		auto lock = lockMainThread();
+		refreshParamCache();
+		cbor.openArray();
+		for (uint32_t i = 0; i < paramCache.size(); ++i) {
+			auto &param = paramCache[i];
+			double value = paramTracker.value(i);
 			cbor.openMap();
 
 			cbor.addUtf8("id");
-			cbor.addInt(info.id);
+			cbor.addInt(param.id);
 			cbor.addUtf8("flags");
-			cbor.addInt(info.flags);
+			cbor.addInt(param.flags);
 			cbor.addUtf8("name");
-			info.name[255] = 0; // ensure null-terminated
-			cbor.addUtf8(info.name);
+			cbor.addUtf8(param.name);
 			cbor.addUtf8("module");
-			info.module[1023] = 0;
-			cbor.addUtf8(info.module);
+			cbor.addUtf8(param.module);
 			cbor.addUtf8("min");
-			cbor.addFloat(info.min_value);
+			cbor.addFloat(param.min);
 			cbor.addUtf8("max");
-			cbor.addFloat(info.max_value);
+			cbor.addFloat(param.max);
 			cbor.addUtf8("default");
-			cbor.addFloat(info.default_value);
-			
+			cbor.addFloat(param.defaultValue);
+			cbor.addUtf8("value");
+			cbor.addFloat(value);
+			if (param.hasText && param.textValue == value) {
+				cbor.addUtf8("text");
+				cbor.addUtf8(param.text);
+			}
+
 			cbor.close();
 		}
 		cbor.close(); // array
 	}
+	// Parameter changes reported by the plugin since the last poll, as packed `PolledParam`s
+	struct PolledParam {
+		double value;
+		wclap_id id;
+		uint32_t flags; // 1 = gesture in progress
+	};
+	size_t pollParams(std::vector<unsigned char> &buffer) {
+		auto lock = lockMainThread();
+		refreshParamCache();
+		buffer.resize(0);
+		return paramTracker.poll([&](uint32_t index, double value, bool gesture){
+			PolledParam polled{value, paramTracker.idAt(index), gesture ? 1u : 0u};
+			auto offset = buffer.size();
+			buffer.resize(offset + sizeof(PolledParam));
+			std::memcpy(buffer.data() + offset, &polled, sizeof(PolledParam));
+		});
+	}
+	double activeSampleRate = 0;
+	uint32_t activeMaxFrames = 0;
+	// Whether `params.flush()` is an audio-thread call (active) or a main-thread one
+	std::atomic<bool> activated{false};
 	bool start(double sRate, uint32_t minFrames, uint32_t maxFrames, CborWriter &cbor) {
+		auto lock = lockMainThread();
+		refreshParamCache(); // the tracker starts from the plugin's current values
+		activeSampleRate = sRate;
+		activeMaxFrames = maxFrames;
 		if (!callPlugin(pluginPtr[&wclap_plugin::activate], sRate, minFrames, maxFrames)) {
 			cbor.addNull();
 			return false;
 		}
+		activated = true;
 		if (!callPlugin(pluginPtr[&wclap_plugin::start_processing])) {
 			cbor.addNull();
 			return false;
 		}
 
+		// The port layout and buffers are kept between start/stop cycles, unless the ports change or we need bigger buffers
+		if (audioLayoutStale.exchange(false) || !processStructPtr || maxFrames > audioLayoutMaxFrames) {
+			buildAudioLayout(maxFrames);
+		} else {
+			for (auto &channel : audioChannels) {
+				channel.buffer = channel.ownBuffer;
+				instance->set(channel.data32, channel.buffer, channel.index);
+			}
+		}
+		
+		// Also return pointers to those buffers
+		auto writePorts = [&](const std::vector<AudioPort> &ports) {
+			cbor.openArray(ports.size());
+			for (auto &port : ports) {
+				cbor.openArray(port.channelCount);
+				for (uint32_t c = 0; c < port.channelCount; ++c) {
+					cbor.addInt(audioChannels[port.firstChannel + c].ownBuffer.wasmPointer);
+				}
+			}
+		};
+		cbor.openMap(2);
+		cbor.addUtf8("inputs");
+		writePorts(inputPorts);
+		cbor.addUtf8("outputs");
+		writePorts(outputPorts);
+		return true;
+	}
+	// Set by `audioPortsRescan()`
+	std::atomic<bool> audioLayoutStale{true};
+	uint32_t audioLayoutMaxFrames = 0;
+	uint32_t audioLayoutBuilds = 0;
+	void buildAudioLayout(uint32_t maxFrames) {
+		++audioLayoutBuilds;
+		audioLayoutMaxFrames = maxFrames;
 		// Set up a single process struct (to be re-used each time) with sufficiently big buffers
 		wclap_process processStruct{
 			.steady_time=-1,
@@ -308,125 +841,279 @@ struct HostedPlugin {
 			.out_events=outputEventsPtr
 		};
 		audioThreadScope.reset();
+		audioChannels.clear();
+		uint32_t layoutStart = 0; // the first thing we place, to measure the layout's size
+
+		inputPorts.clear();
+		outputPorts.clear();
 
 		if (audioPortsExtPtr) {
 			wclap_audio_port_info portInfo;
 			auto portInfoPtr = audioThreadScope.copyAcross(portInfo);
+			layoutStart = portInfoPtr.wasmPointer;
 
 			auto audioPorts = instance->get(audioPortsExtPtr);
-			auto inputPortCount = callPlugin(audioPorts.count, true);
-			processStruct.audio_inputs_count = inputPortCount;
-			auto inputBuffersPtr = audioThreadScope.array<wclap_audio_buffer>(inputPortCount);
-			processStruct.audio_inputs = inputBuffersPtr;
-			for (uint32_t p = 0; p < inputPortCount; ++p) {
-				callPlugin(audioPorts.get, p, true, portInfoPtr);
-				portInfo = instance->get(portInfoPtr);
-
-				auto channelCount = portInfo.channel_count;
-				auto data32Ptr = audioThreadScope.array<Pointer<float>>(channelCount);
-				for (uint32_t c = 0; c < channelCount; ++c) {
-					instance->set(data32Ptr, audioThreadScope.array<float>(maxFrames), c);
-				}
-				wclap_audio_buffer inputBuffer{
-					.data32=data32Ptr,
-					.data64={0},
-					.channel_count=channelCount,
-					.latency=0,
-					.constant_mask=0
-				};
-				instance->set(inputBuffersPtr, inputBuffer, p);
-			}
-			auto outputPortCount = callPlugin(audioPorts.count, false);
-			processStruct.audio_outputs_count = outputPortCount;
-			processStruct.audio_outputs = audioThreadScope.array<wclap_audio_buffer>(outputPortCount);
-			for (uint32_t p = 0; p < outputPortCount; ++p) {
-				callPlugin(audioPorts.get, p, true, portInfoPtr);
-				portInfo = instance->get(portInfoPtr);
-
-				auto channelCount = portInfo.channel_count;
-				auto data32Ptr = audioThreadScope.array<Pointer<float>>(channelCount);
-				for (uint32_t c = 0; c < channelCount; ++c) {
-					instance->set(data32Ptr, audioThreadScope.array<float>(maxFrames), c);
+			auto addPorts = [&](bool isInput, std::vector<AudioPort> &ports) {
+				auto portCount = callPlugin(audioPorts.count, isInput);
+				auto buffersPtr = audioThreadScope.array<wclap_audio_buffer>(portCount);
+				for (uint32_t p = 0; p < portCount; ++p) {
+					callPlugin(audioPorts.get, p, isInput, portInfoPtr);
+					portInfo = instance->get(portInfoPtr);
+
+					auto channelCount = portInfo.channel_count;
+					ports.push_back({portInfo.id, portInfo.in_place_pair, uint32_t(audioChannels.size()), channelCount});
+					auto data32Ptr = audioThreadScope.array<Pointer<float>>(channelCount);
+					for (uint32_t c = 0; c < channelCount; ++c) {
+						auto buffer = audioThreadScope.array<float>(maxFrames);
+						instance->set(data32Ptr, buffer, c);
+						audioChannels.push_back({data32Ptr, c, buffer, buffer});
+					}
+					wclap_audio_buffer audioBuffer{
+						.data32=data32Ptr,
+						.data64={0},
+						.channel_count=channelCount,
+						.latency=0,
+						.constant_mask=0
+					};
+					instance->set(buffersPtr, audioBuffer, p);
 				}
-				wclap_audio_buffer outputBuffer{
-					.data32=data32Ptr,
-					.data64={0},
-					.channel_count=channelCount,
-					.latency=0,
-					.constant_mask=0
-				};
-				instance->set(processStruct.audio_outputs, outputBuffer, p);
-			}
+				return std::make_pair(buffersPtr, portCount);
+			};
+			std::tie(processStruct.audio_inputs, processStruct.audio_inputs_count) = addPorts(true, inputPorts);
+			std::tie(processStruct.audio_outputs, processStruct.audio_outputs_count) = addPorts(false, outputPorts);
 		}
 		processStructPtr = audioThreadScope.copyAcross(processStruct);
-		
-		// Also return pointers to those buffers
-		cbor.openMap(2);
-		cbor.addUtf8("inputs");
-		cbor.openArray(processStruct.audio_inputs_count);
-		for (uint32_t i = 0; i < processStruct.audio_inputs_count; ++i) {
-			auto buffer = instance->get(processStruct.audio_inputs, i);
-			cbor.openArray(buffer.channel_count);
-			for (uint32_t c = 0; c < buffer.channel_count; ++c) {
-				cbor.addInt(instance->get(buffer.data32, c).wasmPointer);
-			}
-		}
-		cbor.addUtf8("outputs");
-		cbor.openArray(processStruct.audio_outputs_count);
-		for (uint32_t i = 0; i < processStruct.audio_outputs_count; ++i) {
-			auto buffer = instance->get(processStruct.audio_outputs, i);
-			cbor.openArray(buffer.channel_count);
-			for (uint32_t c = 0; c < buffer.channel_count; ++c) {
-				cbor.addInt(instance->get(buffer.data32, c).wasmPointer);
+		if (!layoutStart) layoutStart = processStructPtr.wasmPointer;
+		outputEventScratch = audioThreadScope.reserve(outputEventScratchBytes, EventQueue::alignment).cast<unsigned char>();
+		audioScratch.capacity = audioScratchBytes();
+		audioScratch.base = audioThreadScope.reserve(audioScratch.capacity, EventQueue::alignment).cast<unsigned char>();
+
+		uint64_t layoutBytes = audioScratch.base.wasmPointer + audioScratch.capacity - layoutStart;
+		arenaAccounting.resize(ArenaAccounting::KEPT_PLUGIN, arenaBytes.layout, layoutBytes);
+		arenaBytes.layout = layoutBytes;
+		arenaBytes.layoutHighWater = std::max(arenaBytes.layoutHighWater, layoutBytes);
+	}
+	// Points a channel at a different buffer in the Instance's memory (e.g. another plugin's output), or back to its own if `buffer` is null.
+	// This is a single write, so it's cheap enough to do every block - but only between `process()` calls.
+	bool bindAudio(bool isOutput, uint32_t port, uint32_t channel, Pointer<float> buffer) {
+		auto &ports = isOutput ? outputPorts : inputPorts;
+		if (port >= ports.size() || channel >= ports[port].channelCount) return false;
+		auto &audioChannel = audioChannels[ports[port].firstChannel + channel];
+		if (!buffer) buffer = audioChannel.ownBuffer;
+		audioChannel.buffer = buffer;
+		instance->set(audioChannel.data32, buffer, audioChannel.index);
+		return true;
+	}
+	Pointer<float> boundAudio(bool isOutput, uint32_t port, uint32_t channel) {
+		auto &ports = isOutput ? outputPorts : inputPorts;
+		if (port >= ports.size() || channel >= ports[port].channelCount) return {0};
+		return audioChannels[ports[port].firstChannel + channel].buffer;
+	}
+	// Binds an output port to its in-place pair's input buffers, if the plugin declares one with a matching layout
+	bool bindInPlace(uint32_t outputPort) {
+		if (outputPort >= outputPorts.size()) return false;
+		auto &output = outputPorts[outputPort];
+		if (output.inPlacePair == WCLAP_INVALID_ID) return false;
+		for (auto &input : inputPorts) {
+			if (input.id != output.inPlacePair) continue;
+			if (input.channelCount != output.channelCount) return false;
+			for (uint32_t c = 0; c < output.channelCount; ++c) {
+				auto &outputChannel = audioChannels[output.firstChannel + c];
+				outputChannel.buffer = audioChannels[input.firstChannel + c].buffer;
+				instance->set(outputChannel.data32, outputChannel.buffer, outputChannel.index);
 			}
+			return true;
 		}
-		return true;
+		return false;
+	}
+	void getEventStats(CborWriter &cbor) {
+		auto &stats = eventTransferStats;
+		cbor.openMap(13);
+		cbor.addUtf8("blockEvents");
+		cbor.addInt(stats.blockEvents.load(std::memory_order_relaxed));
+		cbor.addUtf8("blockBytes");
+		cbor.addInt(stats.blockBytes.load(std::memory_order_relaxed));
+		cbor.addUtf8("blockCalls");
+		cbor.addInt(stats.blockCalls.load(std::memory_order_relaxed));
+		cbor.addUtf8("blocks");
+		cbor.addInt(stats.blocks.load(std::memory_order_relaxed));
+		cbor.addUtf8("totalEvents");
+		cbor.addInt(stats.totalEvents.load(std::memory_order_relaxed));
+		cbor.addUtf8("totalBytes");
+		cbor.addInt(stats.totalBytes.load(std::memory_order_relaxed));
+		cbor.addUtf8("totalCalls");
+		cbor.addInt(stats.totalCalls.load(std::memory_order_relaxed));
+		cbor.addUtf8("overflows");
+		cbor.addInt(eventQueue.overflowCount());
+		cbor.addUtf8("scratchOverflows");
+		cbor.addInt(stats.scratchOverflows.load(std::memory_order_relaxed));
+		cbor.addUtf8("scratchDropped");
+		cbor.addInt(stats.scratchDropped.load(std::memory_order_relaxed));
+		cbor.addUtf8("heldDropped");
+		cbor.addInt(stats.heldDropped.load(std::memory_order_relaxed));
+		cbor.addUtf8("rampsDropped");
+		cbor.addInt(stats.rampsDropped.load(std::memory_order_relaxed));
+		cbor.addUtf8("outputDropped");
+		cbor.addInt(stats.outputDropped.load(std::memory_order_relaxed));
 	}
 	void stop() {
+		auto lock = lockMainThread();
 		callPlugin(pluginPtr[&wclap_plugin::stop_processing]);
 		callPlugin(pluginPtr[&wclap_plugin::deactivate]);
+		activated = false;
+		if (paramTrackerResetPending) {
+			paramTrackerResetPending = false;
+			paramInfoStale = true;
+		}
 	}
 	
 	uint32_t process(uint32_t blockLength) {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		auto scoped = audioThreadArena->scoped();
-		while (!pendingEventStarts.empty()) {
-			copyEvent(scoped, pendingEventStarts.size() - 1);
+		// Events scheduled beyond this block are held back, and their times moved along
+		stageEvents([&](const wclap_event_header *event){
+			return event->time < blockLength;
+		});
+		for (auto start : pendingEventStarts) {
+			((wclap_event_header *)(pendingEventBytes.data() + start))->time -= blockLength;
 		}
+		stageRampEvents(blockLength);
 		sortCopiedEvents();
-	
-		instance->set(processStructPtr[&wclap_process::frames_count], blockLength);
-		auto status = callPlugin(pluginPtr[&wclap_plugin::process], processStructPtr);
-		clearEvents();
+		
+		uint32_t status;
+		if (splitAtRampPoints && splitPointCount) {
+			status = processSplit(blockLength);
+		} else {
+			transferCopiedEvents(audioScratch.base, audioScratch.capacity);
+			instance->set(processStructPtr[&wclap_process::frames_count], blockLength);
+			status = callPlugin(pluginPtr[&wclap_plugin::process], processStructPtr);
+		}
+		clearCopiedEvents();
+		return status;
+	}
+	// Processes in sub-blocks, shifting the audio buffers and event times for each
+	uint32_t processSplit(uint32_t blockLength) {
+		// Make event times relative to their sub-block, before they're copied across
+		size_t eventIndex = 0;
+		for (size_t s = 0; s <= splitPointCount; ++s) {
+			uint32_t start = s ? splitPoints[s - 1] : 0;
+			uint32_t end = (s < splitPointCount) ? splitPoints[s] : blockLength;
+			while (eventIndex < copiedInputEventPtrs.size() && copiedInputEventPtrs[eventIndex].time < end) {
+				uint32_t subBlockTime = copiedInputEventPtrs[eventIndex].time - start;
+				std::memcpy(stagedEventBytes.data() + copiedInputEventPtrs[eventIndex].offset + offsetof(wclap_event_header, time), &subBlockTime, sizeof(subBlockTime));
+				++eventIndex;
+			}
+		}
+		transferCopiedEvents(audioScratch.base, audioScratch.capacity);
+		
+		uint32_t status = WCLAP_PROCESS_CONTINUE;
+		eventIndex = 0;
+		for (size_t s = 0; s <= splitPointCount; ++s) {
+			uint32_t start = s ? splitPoints[s - 1] : 0;
+			uint32_t end = (s < splitPointCount) ? splitPoints[s] : blockLength;
+			visibleEventsBegin = eventIndex;
+			while (eventIndex < copiedInputEventPtrs.size() && copiedInputEventPtrs[eventIndex].time < end) ++eventIndex;
+			visibleEventsEnd = eventIndex;
+			
+			for (auto &channel : audioChannels) {
+				auto ptr = channel.buffer;
+				ptr += start;
+				instance->set(channel.data32, ptr, channel.index);
+			}
+			instance->set(processStructPtr[&wclap_process::frames_count], end - start);
+			outputTimeOffset = start;
+			status = callPlugin(pluginPtr[&wclap_plugin::process], processStructPtr);
+			if (status == WCLAP_PROCESS_ERROR) break;
+		}
+		outputTimeOffset = 0;
+		for (auto &channel : audioChannels) {
+			instance->set(channel.data32, channel.buffer, channel.index);
+		}
 		return status;
 	}
+	// Only called by the plugin from inside `process()`/`flush()`, so on the same thread as `copiedInputEventPtrs` is filled
 	uint32_t inputEventsSize() {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		return uint32_t(copiedInputEventPtrs.size());
+		return uint32_t(visibleEventsEnd - visibleEventsBegin);
 	}
 	Pointer<const wclap_event_header> inputEventsGet(uint32_t index) {
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
-		if (index >= copiedInputEventPtrs.size()) return {0};
-		return copiedInputEventPtrs[index].pointer;
+		if (index >= visibleEventsEnd - visibleEventsBegin) return {0};
+		return copiedInputEventPtrs[visibleEventsBegin + index].pointer;
+	}
+	// Other plugins in the same Instance (e.g. in a `PluginGraph`) which receive our output events directly, without going through JS
+	// Event connections within a `PluginGraph`: one queue per connection, so each has a single producer (the upstream plugin's `process()`) and a single consumer (the downstream one's), and neither side locks
+	std::vector<EventQueue *> eventTargets, eventSources;
+	// The graph this plugin is in (at most one), which must be destroyed before the plugin is
+	PluginGraph *graph = nullptr;
+	bool outputEventsToJs = true;
+	// If set, output events are also appended here (aligned to `EventQueue::alignment`), e.g. for offline rendering
+	std::vector<unsigned char> *outputEventCapture = nullptr;
+	void trackOutputEvent(Pointer<const wclap_event_header> event, const wclap_event_header &header) {
+		if (header.space_id != WCLAP_CORE_EVENT_SPACE_ID) return;
+		if (header.type == WCLAP_EVENT_PARAM_VALUE && header.size >= sizeof(wclap_event_param_value)) {
+			auto paramEvent = instance->get(event.cast<const wclap_event_param_value>());
+			auto index = paramTracker.indexOf(paramEvent.param_id);
+			if (index >= 0) paramTracker.changed(index, paramEvent.value);
+		} else if ((header.type == WCLAP_EVENT_PARAM_GESTURE_BEGIN || header.type == WCLAP_EVENT_PARAM_GESTURE_END) && header.size >= sizeof(wclap_event_param_gesture)) {
+			auto gestureEvent = instance->get(event.cast<const wclap_event_param_gesture>());
+			auto index = paramTracker.indexOf(gestureEvent.param_id);
+			if (index >= 0) paramTracker.setGesture(index, header.type == WCLAP_EVENT_PARAM_GESTURE_BEGIN);
+		}
 	}
 	bool outputEventsTryPush(Pointer<const wclap_event_header> event) {
-		auto eventSize = instance->get(event[&wclap_event_header::size]);
-		return pluginOutputEventsTryPush32(this, event.wasmPointer, eventSize);
+		auto header = instance->get(event);
+		auto eventSize = header.size;
+		if (outputTimeOffset && eventSize >= sizeof(wclap_event_header)) {
+			if (eventSize > outputEventScratchBytes) {
+				eventTransferStats.outputDropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			// The plugin's event is `const`, so shift a copy instead
+			alignas(EventQueue::alignment) unsigned char eventBytes[outputEventScratchBytes];
+			instance->getArray(event.cast<const unsigned char>(), eventBytes, eventSize);
+			header.time += outputTimeOffset;
+			std::memcpy(eventBytes + offsetof(wclap_event_header, time), &header.time, sizeof(header.time));
+			instance->setArray(outputEventScratch, eventBytes, eventSize);
+			event = outputEventScratch.cast<const wclap_event_header>();
+		}
+		trackOutputEvent(event, header);
+		bool accepted = false;
+		if (!eventTargets.empty() && eventSize >= sizeof(wclap_event_header) && isRoutableEvent(&header)) {
+			alignas(EventQueue::alignment) unsigned char eventBytes[512];
+			if (eventSize <= sizeof(eventBytes)) {
+				instance->getArray(event.cast<const unsigned char>(), eventBytes, eventSize);
+				for (auto *target : eventTargets) {
+					accepted |= target->push((const wclap_event_header *)eventBytes);
+				}
+			}
+		}
+		if (outputEventCapture && eventSize >= sizeof(wclap_event_header)) {
+			auto &capture = *outputEventCapture;
+			auto offset = capture.size();
+			while (offset%EventQueue::alignment) ++offset;
+			capture.resize(offset + eventSize);
+			instance->getArray(event.cast<const unsigned char>(), capture.data() + offset, eventSize);
+			accepted = true;
+		}
+		if (outputEventsToJs) {
+			accepted |= pluginOutputEventsTryPush32(this, event.wasmPointer, eventSize);
+		}
+		return accepted;
 	}
 	void paramsFlush() {
 		if (!paramsExtPtr) return;
-		std::unique_lock<std::recursive_mutex> lock{pendingEventsMutex};
+		std::unique_lock<std::recursive_mutex> lock{mainThreadMutex, std::defer_lock};
+		if (!activated) lock.lock();
 		
-		auto scoped = audioThreadArena->scoped();
-		for (size_t i = pendingEventStarts.size(); i-- > 0;) {
-			auto *event = getEvent(i);
-			if (event->type == WCLAP_EVENT_PARAM_VALUE || event->type == WCLAP_EVENT_PARAM_MOD || event->type == WCLAP_EVENT_PARAM_GESTURE_BEGIN || event->type == WCLAP_EVENT_PARAM_GESTURE_END) {
-				copyEvent(scoped, i);
-			}
-		}
+		stageEvents(isParamEvent);
 		sortCopiedEvents();
-		
-		callPlugin(paramsExtPtr[&wclap_plugin_params::flush], inputEventsPtr, outputEventsPtr);
+		if (audioScratch.capacity) {
+			transferCopiedEvents(audioScratch.base, audioScratch.capacity);
+			callPlugin(paramsExtPtr[&wclap_plugin_params::flush], inputEventsPtr, outputEventsPtr);
+		} else { // not started yet, so nothing's processing: a temporary scope is fine
+			auto scoped = audioThreadArena->scoped();
+			uint32_t bytes = uint32_t(stagedEventBytes.size());
+			transferCopiedEvents(scoped.reserve(bytes, EventQueue::alignment).cast<unsigned char>(), bytes);
+			callPlugin(paramsExtPtr[&wclap_plugin_params::flush], inputEventsPtr, outputEventsPtr);
+		}
+		clearCopiedEvents();
 	}
 
 	void hostRequestRestart() {
@@ -445,6 +1132,7 @@ struct HostedPlugin {
 	}
 	void audioPortsRescan(uint32_t flag) {
 		LOG_EXPR("host_audio_ports.rescan()");
+		audioLayoutStale = true;
 	}
 		
 	void guiResizeHintsChanged() {
@@ -480,8 +1168,18 @@ struct HostedPlugin {
 	}
 
 	void paramsRescan(uint32_t flags) {
+		if (flags&WCLAP_PARAM_RESCAN_ALL) forgetParamCookies();
+		if (flags&(WCLAP_PARAM_RESCAN_ALL|WCLAP_PARAM_RESCAN_INFO)) paramInfoStale = true;
+		if (flags&WCLAP_PARAM_RESCAN_VALUES) paramValuesStale = true;
 		pluginParamsRescan(this, flags);
 	}
+	// After `RESCAN_ALL`, cookies aren't valid - including ones in events we've already queued, which the consumer clears when it next takes events
+	void forgetParamCookies() {
+		// Under the producer lock, so any event stamped with an old cookie is already in the queue when the consumer sees the flag
+		std::lock_guard<std::mutex> lock{eventProducerMutex};
+		paramTracker.clearCookies();
+		paramCookiesStale.store(true, std::memory_order_release);
+	}
 	void paramsClear(uint32_t paramId, uint32_t flags) {
 		LOG_EXPR("host_params.clear()");
 	}
@@ -497,38 +1195,173 @@ struct HostedPlugin {
 		LOG_EXPR("host_tail.changed()");
 	}
 
-	bool saveState(std::vector<unsigned char> &buffer) {
-		std::unique_lock<std::recursive_mutex> lock{streamMutex};
-		clearStreamAlreadyLocked();
-		if (!callPlugin(stateExtPtr[&wclap_plugin_state::save], ostreamPtr)) {
+	// Saved state uses a compressed envelope (see `state-codec.h`) - loading accepts either
+	bool compressState = false;
+
+	// `compress` uses the `compressState` setting by default
+	bool saveState(std::vector<unsigned char> &buffer, bool compress=true) {
+		auto lock = lockMainThread();
+		PluginStreamPool::Scoped stream{*streamPool, this};
+		stream->startWrite(false, compress && compressState);
+		if (!stream->finishWrite(callPlugin(stateExtPtr[&wclap_plugin_state::save], stream->ostreamPtr))) {
 			buffer.resize(0);
 			return false;
 		}
-		buffer = streamData;
+		std::swap(buffer, stream->data);
 		return true;
 	}
 	bool loadState(const std::vector<unsigned char> &buffer) {
-		std::unique_lock<std::recursive_mutex> lock{streamMutex};
-		clearStreamAlreadyLocked();
-		streamData = buffer;
-		return callPlugin(stateExtPtr[&wclap_plugin_state::load], istreamPtr);
+		auto lock = lockMainThread();
+		PluginStreamPool::Scoped stream{*streamPool, this};
+		stream->data = buffer;
+		paramValuesStale = true;
+		bool success = stream->startRead(false) && callPlugin(stateExtPtr[&wclap_plugin_state::load], stream->istreamPtr);
+		stream->finishRead();
+		return success;
+	}
+
+	// Background save/load, polled with `stateRequestStatus()`
+	static constexpr int32_t stateRequestPending = 0, stateRequestDone = 1, stateRequestFailed = -1, stateRequestUnknown = -2;
+	struct StateRequest {
+		std::atomic<int32_t> status{stateRequestPending};
+		std::vector<unsigned char> data;
+	};
+	std::mutex stateRequestMutex;
+	std::unordered_map<uint32_t, std::shared_ptr<StateRequest>> stateRequests;
+	uint32_t nextStateRequestId = 1;
+	std::mutex stateJobsMutex;
+	std::condition_variable stateJobsDone;
+	uint32_t pendingStateJobs = 0;
+
+	// Returns a request ID (never 0)
+	uint32_t saveStateAsync() {
+		auto request = std::make_shared<StateRequest>();
+		return postStateRequest(request, [this, request](){
+			return saveState(request->data);
+		});
+	}
+	uint32_t loadStateAsync(std::vector<unsigned char> &&data) {
+		auto request = std::make_shared<StateRequest>();
+		request->data = std::move(data);
+		return postStateRequest(request, [this, request](){
+			bool success = loadState(request->data);
+			request->data = {};
+			return success;
+		});
+	}
+	int32_t stateRequestStatus(uint32_t requestId) {
+		std::lock_guard<std::mutex> lock{stateRequestMutex};
+		auto iter = stateRequests.find(requestId);
+		if (iter == stateRequests.end()) return stateRequestUnknown;
+		return iter->second->status.load();
+	}
+	// Forgets a finished request, handing back its saved state (if any)
+	bool finishStateRequest(uint32_t requestId, std::vector<unsigned char> &result) {
+		std::lock_guard<std::mutex> lock{stateRequestMutex};
+		auto iter = stateRequests.find(requestId);
+		if (iter == stateRequests.end()) return false;
+		auto status = iter->second->status.load();
+		if (status == stateRequestPending) return false;
+		std::swap(result, iter->second->data);
+		stateRequests.erase(iter);
+		return status == stateRequestDone;
+	}
+	template<class Fn>
+	uint32_t postStateRequest(std::shared_ptr<StateRequest> request, Fn &&fn) {
+		uint32_t requestId;
+		{
+			std::lock_guard<std::mutex> lock{stateRequestMutex};
+			requestId = nextStateRequestId++;
+			if (!nextStateRequestId) nextStateRequestId = 1;
+			stateRequests[requestId] = request;
+		}
+		if (!stateExtPtr) {
+			request->status = stateRequestFailed;
+			return requestId;
+		}
+		{
+			std::lock_guard<std::mutex> lock{stateJobsMutex};
+			++pendingStateJobs;
+		}
+		stateWorker->post([this, request, fn](){
+			request->status = fn() ? stateRequestDone : stateRequestFailed;
+			// Notified under the lock, so the destructor can't finish waiting (and destroy the condition) before we're done with it
+			std::lock_guard<std::mutex> lock{stateJobsMutex};
+			--pendingStateJobs;
+			stateJobsDone.notify_all();
+		});
+		return requestId;
+	}
+	// Deduplicated state history (e.g. for undo)
+	StateSnapshots stateSnapshots;
+	std::vector<unsigned char> snapshotBuffer;
+	uint32_t saveSnapshot() {
+		auto lock = lockMainThread();
+		if (!stateExtPtr || !saveState(snapshotBuffer, false)) return 0; // raw, so that the chunks can be shared
+		return stateSnapshots.add(snapshotBuffer.data(), snapshotBuffer.size());
+	}
+	bool loadSnapshot(uint32_t snapshotId) {
+		auto lock = lockMainThread();
+		if (!stateSnapshots.get(snapshotId, snapshotBuffer)) return false;
+		return loadState(snapshotBuffer);
+	}
+	bool removeSnapshot(uint32_t snapshotId) {
+		return stateSnapshots.remove(snapshotId);
+	}
+	void getSnapshotStats(CborWriter &cbor) {
+		auto stats = stateSnapshots.stats();
+		cbor.openMap();
+		cbor.addUtf8("snapshots");
+		cbor.addInt(stats.snapshots);
+		cbor.addUtf8("chunks");
+		cbor.addInt(stats.chunks);
+		cbor.addUtf8("storedBytes");
+		cbor.addInt(stats.storedBytes);
+		cbor.addUtf8("snapshotBytes");
+		cbor.addInt(stats.snapshotBytes);
+		cbor.close();
+	}
+	// Streamed through the `stateWrite`/`stateRead` imports, so the state is never held (or copied) here
+	bool saveStateStreaming() {
+		if (!stateExtPtr) return false;
+		auto lock = lockMainThread();
+		PluginStreamPool::Scoped stream{*streamPool, this};
+		stream->startWrite(true, compressState);
+		return stream->finishWrite(callPlugin(stateExtPtr[&wclap_plugin_state::save], stream->ostreamPtr));
+	}
+	bool loadStateStreaming() {
+		if (!stateExtPtr) return false;
+		auto lock = lockMainThread();
+		PluginStreamPool::Scoped stream{*streamPool, this};
+		paramValuesStale = true;
+		bool success = stream->startRead(true) && callPlugin(stateExtPtr[&wclap_plugin_state::load], stream->istreamPtr);
+		stream->finishRead();
+		return success;
 	}
 
 	bool webviewSend(Pointer<const void> buffer, uint32_t size) {
 		// JS can copy directly from instance memory
 		return pluginWebviewSend(this, buffer.wasmPointer, size);
 	}
-	bool getResource(const std::string &path, CborWriter &cbor) {
+	// Encoded results, so that reopening the UI doesn't fetch (or encode) everything again
+	ResourceCache resourceCache;
+	// Writes CBOR into `encoded`: `{type, bytes}`, or `null`
+	bool getResource(const std::string &path, std::vector<unsigned char> &encoded) {
+		if (resourceCache.get(path, encoded)) return true;
+		encoded.resize(0);
+		CborWriter cbor{encoded};
 		if (!webviewExtPtr) {
 			cbor.addNull();
 			return false;
 		}
+		auto generation = resourceCache.generation();
+		auto lock = lockMainThread();
 		
-		auto scoped = arenaPool.scoped();
+		auto scoped = arenaAccounting.temp(arenaPool);
 		auto mimePtr = scoped.array<char>(255);
-		std::unique_lock<std::recursive_mutex> lock{streamMutex};
-		clearStreamAlreadyLocked();
-		if (!callPlugin(webviewExtPtr[&wclap_plugin_webview::get_resource], scoped.writeString(path.c_str()), mimePtr, 255, ostreamPtr)) {
+		PluginStreamPool::Scoped stream{*streamPool, this};
+		stream->startWrite(false, false);
+		if (!stream->finishWrite(callPlugin(webviewExtPtr[&wclap_plugin_webview::get_resource], scoped.writeString(path.c_str()), mimePtr, 255, stream->ostreamPtr))) {
 			cbor.addNull();
 			return false;
 		}
@@ -539,18 +1372,55 @@ struct HostedPlugin {
 		cbor.addUtf8("type");
 		cbor.addUtf8(mime);
 		cbor.addUtf8("bytes");
-		cbor.addBytes(streamData.data(), streamData.size());
+		cbor.addBytes(stream->data.data(), stream->data.size());
+		resourceCache.put(path, encoded, generation);
 		return true;
 	}
+	// Incoming webview messages: JS writes straight into this (see `messageBuffer()`), which is kept between messages
+	ArenaPtr messageArena;
+	Pointer<unsigned char> messageBufferPtr;
+	uint32_t messageCapacity = 0;
+	Pointer<unsigned char> messageBuffer(uint32_t length) {
+		if (length > messageCapacity) {
+			if (messageArena) {
+				arenaPool.returnToPool(messageArena);
+				arenaAccounting.release(ArenaAccounting::KEPT_MESSAGE, arenaBytes.message);
+			}
+			uint32_t capacity = 4096;
+			while (capacity < length) capacity *= 2;
+			auto scoped = arenaPool.scoped();
+			messageBufferPtr = scoped.array<unsigned char>(capacity);
+			messageArena = scoped.commit();
+			messageCapacity = capacity;
+			arenaBytes.message = capacity;
+			arenaAccounting.keep(ArenaAccounting::KEPT_MESSAGE, arenaBytes.message);
+		}
+		return messageBufferPtr;
+	}
+	// Delivers the first `length` bytes of `messageBuffer()`
+	void receiveMessage(uint32_t length) {
+		if (!webviewExtPtr || length > messageCapacity) return;
+		auto lock = lockMainThread();
+		callPlugin(webviewExtPtr[&wclap_plugin_webview::receive], messageBufferPtr.cast<const void>(), length);
+	}
 	void message(unsigned char *bytes, uint32_t length) {
 		if (!webviewExtPtr) return;
-
-		// TODO: send directly to the Instance's memory, instead of bouncing through the host memory
-		auto scoped = arenaPool.scoped();
-		auto ptr = scoped.array<unsigned char>(length);
-		instance->setArray(ptr, bytes, length);
-
-		callPlugin(webviewExtPtr[&wclap_plugin_webview::receive], ptr.cast<const void>(), length);
+		instance->setArray(messageBuffer(length), bytes, length);
+		receiveMessage(length);
+	}
+	// Bytes this plugin has placed in the Instance's memory, which it keeps until it's destroyed (or the layout/message buffer is replaced)
+	void getMemoryStats(CborWriter &cbor) {
+		cbor.openMap(5);
+		cbor.addUtf8("hostBytes");
+		cbor.addInt(arenaBytes.host);
+		cbor.addUtf8("layoutBytes");
+		cbor.addInt(arenaBytes.layout);
+		cbor.addUtf8("layoutHighWater");
+		cbor.addInt(arenaBytes.layoutHighWater);
+		cbor.addUtf8("layoutBuilds");
+		cbor.addInt(audioLayoutBuilds);
+		cbor.addUtf8("messageBytes");
+		cbor.addInt(arenaBytes.message);
 	}
 };
 
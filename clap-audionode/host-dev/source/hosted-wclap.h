@@ -1,10 +1,17 @@
 #pragma once
 
 #include "./common.h"
+#include "./arena-accounting.h"
+#include "./background-worker.h"
 #include "./hosted-plugin.h"
 #include "wclap/index-lookup.hpp"
 
+#include <atomic>
+#include <cstring>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 #include <iostream>
 
@@ -27,33 +34,76 @@ struct HostedWclap {
 	Pointer<wclap_host_webview> webviewExtPtr;
 	wclap_input_events inputEvents;
 	wclap_output_events outputEvents;
-	wclap_istream istream;
-	wclap_ostream ostream;
 
 	// Instance and supporting state
 	std::unique_ptr<Instance> instance;
 	wclap::MemoryArenaPool<Instance, false> arenaPool;
 	std::unique_ptr<wclap::MemoryArena<Instance, false>> globalArena;
+	ArenaAccounting arenaAccounting; // shared with the plugins (see `getMemoryStats()`)
+	PluginStreamPool streamPool;
+	BackgroundWorker stateWorker; // runs background state saves/loads
 	
 	wclap::IndexLookup<HostedPlugin> pluginLookup;
 	Pointer<wclap_plugin_factory> pluginFactoryPtr;
 	
+	// Plugins might ask from the audio thread, so the lookup only records unsupported IDs, and `logUnsupportedExtensions()` logs them from the main thread
+	std::atomic<uint32_t> unsupportedExtensionCount{0};
+	uint32_t loggedUnsupportedCount = 0;
+	std::atomic_flag lastUnsupportedBusy = ATOMIC_FLAG_INIT; // never waited on: whoever finds it set just skips
+	char lastUnsupported[256] = {};
+	std::string lastUnsupportedExtension() {
+		if (lastUnsupportedBusy.test_and_set(std::memory_order_acquire)) return "";
+		std::string id = lastUnsupported;
+		lastUnsupportedBusy.clear(std::memory_order_release);
+		return id;
+	}
+	void logUnsupportedExtensions() {
+		auto count = unsupportedExtensionCount.load(std::memory_order_relaxed);
+		if (count == loggedUnsupportedCount) return;
+		// Some plugins ask repeatedly (even from `process()`), so only log the first few, then at powers of two
+		auto topBit = [](uint32_t n){
+			uint32_t bit = 0;
+			while (n >>= 1) ++bit;
+			return bit;
+		};
+		bool log = loggedUnsupportedCount < 8 || topBit(count) > topBit(loggedUnsupportedCount);
+		loggedUnsupportedCount = count;
+		if (log) {
+			std::cout << "Unsupported WCLAP host extension: " << lastUnsupportedExtension() << " (" << count << " unsupported queries)" << std::endl;
+		}
+	}
 	static Pointer<const void> hostGetExtension32(void *context, Pointer<const wclap_host> host, Pointer<const char> extensionIdPtr) {
 		auto &self = *(HostedWclap *)context;
-		char extensionId[256] = {};
-		self.instance->getArray(extensionIdPtr, extensionId, 255);
+		if (!extensionIdPtr) return {0};
+		// Copies only up to the NUL (bounded, for unterminated IDs)
+		char extensionId[256];
+		auto length = self.instance->countUntil(extensionIdPtr, 0, 255);
+		self.instance->getArray(extensionIdPtr, extensionId, length);
+		extensionId[length] = 0;
 		
-		if (!std::strcmp(extensionId, "clap.audio-ports")) return self.audioPortsExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.gui")) return self.guiExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.latency")) return self.latencyExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.note-ports")) return self.notePortsExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.params")) return self.paramsExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.state")) return self.stateExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.tail")) return self.tailExtPtr.cast<const void>();
-		if (!std::strcmp(extensionId, "clap.webview/3")) return self.webviewExtPtr.cast<const void>();
+		// The supported IDs all have different lengths (duplicate `case`s won't compile), so this is one comparison
+#define WCLAP_HOST_EXTENSION(id, ptr) \
+		case sizeof(id) - 1: \
+			if (!std::memcmp(extensionId, id, sizeof(id) - 1)) return self.ptr.cast<const void>(); \
+			break;
+		switch (length) {
+			WCLAP_HOST_EXTENSION("clap.audio-ports", audioPortsExtPtr)
+			WCLAP_HOST_EXTENSION("clap.gui", guiExtPtr)
+			WCLAP_HOST_EXTENSION("clap.latency", latencyExtPtr)
+			WCLAP_HOST_EXTENSION("clap.note-ports", notePortsExtPtr)
+			WCLAP_HOST_EXTENSION("clap.params", paramsExtPtr)
+			WCLAP_HOST_EXTENSION("clap.state", stateExtPtr)
+			WCLAP_HOST_EXTENSION("clap.tail", tailExtPtr)
+			WCLAP_HOST_EXTENSION("clap.webview/3", webviewExtPtr)
+		}
+#undef WCLAP_HOST_EXTENSION
 		
-		std::cout << "Unsupported WCLAP host extension: " << extensionId << std::endl;
-		return {0}; // no extensions for now
+		if (!self.lastUnsupportedBusy.test_and_set(std::memory_order_acquire)) {
+			std::memcpy(self.lastUnsupported, extensionId, length + 1);
+			self.lastUnsupportedBusy.clear(std::memory_order_release);
+		}
+		self.unsupportedExtensionCount.fetch_add(1, std::memory_order_relaxed);
+		return {0};
 	}
 	static void hostRequestRestart32(void *context, Pointer<const wclap_host> host) {
 		auto *plugin = getPlugin(context, host);
@@ -85,13 +135,13 @@ struct HostedWclap {
 	}
 	
 	static int64_t istreamRead32(void *context, Pointer<const wclap_istream> stream, Pointer<void> buffer, uint64_t size) {
-		auto *plugin = getPlugin(context, stream);
-		if (plugin) return plugin->istreamRead(buffer, size);
+		auto *pluginStream = getStream(context, stream);
+		if (pluginStream) return pluginStream->read(buffer, size);
 		return -1;
 	}
 	static int64_t ostreamWrite32(void *context, Pointer<const wclap_ostream> stream, Pointer<const void> buffer, uint64_t size) {
-		auto *plugin = getPlugin(context, stream);
-		if (plugin) return plugin->ostreamWrite(buffer, size);
+		auto *pluginStream = getStream(context, stream);
+		if (pluginStream) return pluginStream->write(buffer, size);
 		return -1;
 	}
 
@@ -173,7 +223,7 @@ struct HostedWclap {
 		return false;
 	}
 
-	HostedWclap(Instance *instance) : instance(instance), arenaPool(instance), globalArena(arenaPool.getOrCreate()) {
+	HostedWclap(Instance *instance) : instance(instance), arenaPool(instance), globalArena(arenaPool.getOrCreate()), streamPool(instance, arenaPool, arenaAccounting) {
 		if (instance->is64()) return;
 
 		// Set up all the host structures we'll need later
@@ -195,10 +245,10 @@ struct HostedWclap {
 		inputEvents.get = instance->registerHost32(this, inputEventsGet32);
 		outputEvents.ctx = {0};
 		outputEvents.try_push = instance->registerHost32(this, outputEventsTryPush32);
-		istream.ctx = {0};
-		istream.read = instance->registerHost32(this, istreamRead32);
-		ostream.ctx = {0};
-		ostream.write = instance->registerHost32(this, ostreamWrite32);
+		streamPool.istream.ctx = {0}; // each stream gets its own copy, with its index
+		streamPool.istream.read = instance->registerHost32(this, istreamRead32);
+		streamPool.ostream.ctx = {0};
+		streamPool.ostream.write = instance->registerHost32(this, ostreamWrite32);
 		
 		// Host extensions - functions defined above
 		audioPortsExtPtr = globalScoped.copyAcross(wclap_host_audio_ports{
@@ -235,6 +285,7 @@ struct HostedWclap {
 		});
 
 		globalScoped.commit(); // Save this stuff for the WCLAP lifetime
+		arenaAccounting.keep(ArenaAccounting::KEPT_GLOBAL, webviewExtPtr.wasmPointer + sizeof(wclap_host_webview) - host.name.wasmPointer);
 		
 		instance->init();
 		
@@ -242,7 +293,7 @@ struct HostedWclap {
 		auto entry = instance->get(instance->entry32);
 		
 		// Call clap_entry.init();
-		auto scoped = arenaPool.scoped();
+		auto scoped = arenaAccounting.temp(arenaPool);
 		if (!instance->call(entry.init, scoped.writeString(instance->path()))) return;
 
 		// Get the plugin factory
@@ -253,6 +304,7 @@ struct HostedWclap {
 		ok = true;
 	}
 	~HostedWclap() {
+		clearWarmPools();
 		if (ok) { // Call clap_entry.deinit()
 			auto entry = instance->get(instance->entry32);
 			instance->call(entry.deinit);
@@ -271,7 +323,7 @@ struct HostedWclap {
 	void getInfo(CborWriter &cbor) {
 		cbor.openMap();
 		
-		auto scoped = arenaPool.scoped();
+		auto scoped = arenaAccounting.temp(arenaPool);
 
 		auto entry = instance->get(instance->entry32);
 
@@ -312,42 +364,203 @@ struct HostedWclap {
 		Pointer<void> dataPtr = self.instance->get(events[&WclapType::ctx]);
 		return self.pluginLookup.get(int32_t(dataPtr.wasmPointer));
 	}
+	template<class WclapType>
+	static PluginStream * getStream(void *context, Pointer<const WclapType> stream) {
+		auto &self = *(HostedWclap *)context;
+		Pointer<void> dataPtr = self.instance->get(stream[&WclapType::ctx]);
+		return self.streamPool.lookup.get(int32_t(dataPtr.wasmPointer));
+	}
 	
+	// Pre-created (and `init()`ed) plugins for particular IDs, so `createPlugin()` can hand one out immediately
+	struct WarmPool {
+		size_t size = 0;
+		std::vector<HostedPlugin *> plugins;
+	};
+	struct WarmPoolStats {
+		uint64_t hits = 0, misses = 0;
+	};
+	std::mutex warmMutex;
+	std::unordered_map<std::string, WarmPool> warmPools;
+	WarmPoolStats warmStats;
+
+	// A size of 0 removes the pool.  Doesn't create anything: call `refillWarmPools()` to do that.
+	void setWarmPoolSize(const std::string &pluginId, size_t size) {
+		std::vector<HostedPlugin *> excess;
+		{
+			std::lock_guard<std::mutex> lock{warmMutex};
+			auto &pool = warmPools[pluginId];
+			pool.size = size;
+			while (pool.plugins.size() > size) {
+				excess.push_back(pool.plugins.back());
+				pool.plugins.pop_back();
+			}
+			if (!size) warmPools.erase(pluginId);
+		}
+		for (auto *plugin : excess) delete plugin;
+	}
+	// Creates up to `maxCount` plugins to top up the pools, returning how many it created.  Plugin creation is main-thread, so call this when the main thread is idle, not from another thread.
+	size_t refillWarmPools(size_t maxCount=size_t(-1)) {
+		size_t created = 0;
+		while (created < maxCount) {
+			std::string pluginId;
+			{
+				std::lock_guard<std::mutex> lock{warmMutex};
+				for (auto &pair : warmPools) {
+					if (pair.second.plugins.size() < pair.second.size) {
+						pluginId = pair.first;
+						break;
+					}
+				}
+			}
+			if (pluginId.empty()) break;
+			auto *plugin = createPluginCold(pluginId.c_str());
+			if (!plugin) { // stop trying for this one
+				setWarmPoolSize(pluginId, 0);
+				continue;
+			}
+			++created;
+			std::lock_guard<std::mutex> lock{warmMutex};
+			auto iter = warmPools.find(pluginId);
+			if (iter == warmPools.end() || iter->second.plugins.size() >= iter->second.size) {
+				delete plugin; // pool was shrunk meanwhile
+			} else {
+				iter->second.plugins.push_back(plugin);
+			}
+		}
+		logUnsupportedExtensions(); // also picks up queries made while processing
+		return created;
+	}
+	WarmPoolStats warmPoolStats() {
+		std::lock_guard<std::mutex> lock{warmMutex};
+		return warmStats;
+	}
+	void getWarmPoolStats(CborWriter &cbor) {
+		std::lock_guard<std::mutex> lock{warmMutex};
+		cbor.openMap(3);
+		cbor.addUtf8("hits");
+		cbor.addInt(warmStats.hits);
+		cbor.addUtf8("misses");
+		cbor.addInt(warmStats.misses);
+		cbor.addUtf8("warm");
+		cbor.openMap(warmPools.size());
+		for (auto &pair : warmPools) {
+			cbor.addUtf8(pair.first);
+			cbor.addInt(pair.second.plugins.size());
+		}
+	}
+	// Instance-memory use by the host: see `ArenaAccounting`
+	void getMemoryStats(CborWriter &cbor) {
+		auto &accounting = arenaAccounting;
+		auto writeLevel = [&](const char *key, ArenaAccounting::Level &level){
+			cbor.addUtf8(key);
+			cbor.openMap(2);
+			cbor.addUtf8("current");
+			cbor.addInt(level.current.load(std::memory_order_relaxed));
+			cbor.addUtf8("highWater");
+			cbor.addInt(level.highWater.load(std::memory_order_relaxed));
+		};
+		cbor.openMap(7);
+		writeLevel("arenas", accounting.arenas); // high-water mark is the pool size
+		writeLevel("keptBytes", accounting.keptBytes);
+		cbor.addUtf8("kept");
+		cbor.openMap(ArenaAccounting::KEPT_KINDS);
+		for (int kind = 0; kind < ArenaAccounting::KEPT_KINDS; ++kind) {
+			cbor.addUtf8(ArenaAccounting::kindNames[kind]);
+			cbor.openMap(2);
+			writeLevel("arenas", accounting.kept[kind].arenas);
+			writeLevel("bytes", accounting.kept[kind].bytes);
+		}
+		cbor.addUtf8("scopes");
+		cbor.openMap(5);
+		writeLevel("open", accounting.scopes);
+		cbor.addUtf8("total");
+		cbor.addInt(accounting.scopeCount.load(std::memory_order_relaxed));
+		cbor.addUtf8("long"); // held for longer than `ArenaAccounting::longScopeNs`
+		cbor.addInt(accounting.longScopes.load(std::memory_order_relaxed));
+		cbor.addUtf8("longestNs");
+		cbor.addInt(accounting.longestScopeNs.load(std::memory_order_relaxed));
+		cbor.addUtf8("longNs");
+		cbor.addInt(ArenaAccounting::longScopeNs);
+		auto streamStats = streamPool.stats();
+		cbor.addUtf8("streams");
+		cbor.openMap(2);
+		cbor.addUtf8("total");
+		cbor.addInt(streamStats.streams);
+		cbor.addUtf8("free");
+		cbor.addInt(streamStats.free);
+		size_t warmCount = 0;
+		{
+			std::lock_guard<std::mutex> lock{warmMutex};
+			for (auto &pair : warmPools) warmCount += pair.second.plugins.size();
+		}
+		cbor.addUtf8("warmPlugins");
+		cbor.addInt(warmCount);
+		cbor.addUtf8("unsupportedExtensions");
+		cbor.openMap(2);
+		cbor.addUtf8("count");
+		cbor.addInt(unsupportedExtensionCount.load(std::memory_order_relaxed));
+		cbor.addUtf8("last");
+		cbor.addUtf8(lastUnsupportedExtension());
+	}
+	void clearWarmPools() {
+		std::lock_guard<std::mutex> lock{warmMutex};
+		for (auto &pair : warmPools) {
+			for (auto *plugin : pair.second.plugins) delete plugin;
+		}
+		warmPools.clear();
+	}
+
 	HostedPlugin * createPlugin(const char *pluginId) {
+		{
+			std::lock_guard<std::mutex> lock{warmMutex};
+			auto iter = warmPools.find(pluginId);
+			if (iter != warmPools.end()) {
+				auto &plugins = iter->second.plugins;
+				if (!plugins.empty()) {
+					++warmStats.hits;
+					auto *plugin = plugins.back();
+					plugins.pop_back();
+					return plugin;
+				}
+				++warmStats.misses;
+			}
+		}
+		return createPluginCold(pluginId);
+	}
+	HostedPlugin * createPluginCold(const char *pluginId) {
 		auto scoped = arenaPool.scoped();
 
 		// Write the host structures into WCLAP memory
 		auto hostPtr = scoped.copyAcross(host);
 		auto inputEventsPtr = scoped.copyAcross(inputEvents);
 		auto outputEventsPtr = scoped.copyAcross(outputEvents);
-		auto istreamPtr = scoped.copyAcross(istream);
-		auto ostreamPtr = scoped.copyAcross(ostream);
 		// Attempt to actually create the plugin using the plugin factory
 		auto fnPtr = pluginFactoryPtr[&wclap_plugin_factory::create_plugin];
-		auto pluginPtr = instance->call(fnPtr, pluginFactoryPtr, hostPtr, scoped.writeString(pluginId));
+		auto pluginIdPtr = scoped.writeString(pluginId);
+		auto pluginPtr = instance->call(fnPtr, pluginFactoryPtr, hostPtr, pluginIdPtr);
 		if (!pluginPtr) {
 			std::cerr << "Failed to create WCLAP plugin: " << pluginId << "\n";
 			return nullptr;
 		}
 
 		// `scoped.commit()` keeps the host structures above for the plugin's lifetime, and also claims the arena
-		auto *plugin = new HostedPlugin(pluginPtr, instance.get(), scoped.commit());
+		auto *plugin = new HostedPlugin(pluginPtr, instance.get(), scoped.commit(), arenaAccounting);
 		uint32_t pluginIndex = pluginLookup.retain(plugin);
 		plugin->pluginIndex = pluginIndex;
 		plugin->inputEventsPtr = inputEventsPtr;
 		plugin->outputEventsPtr = outputEventsPtr;
-		plugin->istreamPtr = istreamPtr;
-		plugin->ostreamPtr = ostreamPtr;
+		plugin->streamPool = &streamPool;
+		plugin->stateWorker = &stateWorker;
+		plugin->arenaBytes.host = pluginIdPtr.wasmPointer + std::strlen(pluginId) + 1 - hostPtr.wasmPointer;
+		arenaAccounting.keep(ArenaAccounting::KEPT_PLUGIN, plugin->arenaBytes.host);
 		
 		// Write the plugin index into the context pointers
 		instance->set(hostPtr[&wclap_host::host_data], {pluginIndex});
 		instance->set(inputEventsPtr[&wclap_input_events::ctx], {pluginIndex});
 		instance->set(outputEventsPtr[&wclap_output_events::ctx], {pluginIndex});
-		instance->set(istreamPtr[&wclap_istream::ctx], {pluginIndex});
-		instance->set(ostreamPtr[&wclap_ostream::ctx], {pluginIndex});
 		
-		std::cout << "Created WCLAP plugin: " << pluginId << "\n";
 		plugin->init();
+		logUnsupportedExtensions();
 		return plugin;
 	}
 };
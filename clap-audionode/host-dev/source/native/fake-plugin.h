@@ -0,0 +1,454 @@
+/* A fake WCLAP module for the native `Instance`, which exercises the host's hot paths: events, params, state and process.
+
+It has a single plugin ("fake") with stereo audio in/out, a note input, `paramCount` parameters (parameter 0 is a gain applied to the audio) and a state of `stateBytes`.  Note events are echoed to the output events, and `outputParams` are reported as parameter changes (e.g. from the plugin's own UI).*/
+
+#pragma once
+
+#include "./native-instance.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace impl32 {
+using namespace wclap32;
+
+struct FakePlugin {
+	struct Config {
+		uint32_t paramCount = 8;
+		uint32_t stateBytes = 4096;
+		uint32_t channels = 2;
+		std::string pluginId = "fake";
+	};
+	static constexpr wclap_id firstParamId = 1000;
+	static constexpr uint32_t streamChunk = 4096;
+
+	// Use as the `Instance` constructor argument
+	static Instance::EntryInit entry(Config config, std::shared_ptr<FakePlugin> *moduleOut=nullptr) {
+		auto module = std::make_shared<FakePlugin>(config);
+		if (moduleOut) *moduleOut = module;
+		return [module](Instance &instance) {
+			return module->setUp(instance);
+		};
+	}
+
+	// Counts, for checking what the host did
+	struct Stats {
+		uint64_t processCalls = 0, processedFrames = 0;
+		uint64_t paramEvents = 0, noteEvents = 0;
+		uint64_t lateEvents = 0; // events timed at or after the end of their `process()` block
+		uint64_t cookieEvents = 0, cookieMismatches = 0;
+		uint64_t stateSaves = 0, stateLoads = 0;
+	} stats;
+
+	// Main-thread methods called while another was still running (which CLAP doesn't allow), and a delay for state saves to give them the chance
+	std::atomic<uint64_t> mainThreadOverlaps{0};
+	std::atomic<uint32_t> stateSaveDelayMs{0};
+
+	FakePlugin(Config config) : config(config) {}
+
+	// Reported (and cleared) by the next `process()`: a gesture can be begun before the value, and/or ended after it
+	struct OutputParam {
+		wclap_id id;
+		double value;
+		bool beginGesture = false, endGesture = false;
+	};
+	std::vector<OutputParam> outputParams;
+
+	// Changes the parameter list (call while nothing's processing, then have the host rescan)
+	void setParamCount(uint32_t count) {
+		config.paramCount = count;
+		for (auto &plugin : plugins) plugin->values.resize(count, 0.5);
+	}
+
+private:
+	Config config;
+	Instance *instance = nullptr;
+
+	std::atomic<int> mainThreadCalls{0};
+	struct MainThreadCall {
+		FakePlugin &module;
+		MainThreadCall(FakePlugin &module) : module(module) {
+			if (module.mainThreadCalls++ > 0) ++module.mainThreadOverlaps;
+		}
+		~MainThreadCall() {
+			--module.mainThreadCalls;
+		}
+	};
+
+	struct Plugin {
+		bool alive = true;
+		Pointer<wclap_plugin> ptr;
+		Pointer<const wclap_host> host;
+		std::vector<double> values;
+		Pointer<unsigned char> streamBuffer;
+		Pointer<wclap_event_param_value> outputEvent;
+		std::vector<float> audio;
+		std::vector<unsigned char> state;
+	};
+	std::vector<std::unique_ptr<Plugin>> plugins;
+
+	Pointer<wclap_plugin_entry> entryPtr;
+	Pointer<wclap_plugin_factory> factoryPtr;
+	Pointer<wclap_plugin_descriptor> descriptorPtr;
+	Pointer<wclap_plugin_audio_ports> audioPortsPtr;
+	Pointer<wclap_plugin_note_ports> notePortsPtr;
+	Pointer<wclap_plugin_params> paramsPtr;
+	Pointer<wclap_plugin_state> statePtr;
+	Pointer<wclap_plugin_tail> tailPtr;
+	wclap_plugin pluginTemplate;
+
+	template<class T>
+	Pointer<T> alloc(size_t count=1) {
+		return instance->malloc32(uint32_t(sizeof(T)*count)).template cast<T>();
+	}
+	template<class T>
+	Pointer<T> copy(const T &value) {
+		auto ptr = alloc<T>();
+		instance->set(ptr, value);
+		return ptr;
+	}
+	Pointer<const char> writeString(const std::string &str) {
+		auto ptr = alloc<char>(str.size() + 1);
+		instance->setArray(ptr, str.c_str(), str.size() + 1);
+		return ptr;
+	}
+	std::string readString(Pointer<const char> ptr) {
+		auto length = instance->countUntil(ptr, 0, 1024);
+		std::string str(length, 0);
+		instance->getArray(ptr, &str[0], length);
+		return str;
+	}
+	template<class R, class... A>
+	Function<R, A...> fn(typename std::common_type<std::function<R(A...)>>::type f) {
+		return instance->registerFunction32<R, A...>(f);
+	}
+	Plugin * getPlugin(Pointer<const wclap_plugin> ptr) {
+		auto index = instance->get(ptr[&wclap_plugin::plugin_data]).wasmPointer;
+		if (!index || index > plugins.size()) std::abort();
+		return plugins[index - 1].get();
+	}
+	int32_t paramIndex(wclap_id id) {
+		if (id < firstParamId || id >= firstParamId + config.paramCount) return -1;
+		return int32_t(id - firstParamId);
+	}
+
+	void handleEvent(Plugin *plugin, Pointer<const wclap_event_header> eventPtr, Pointer<const wclap_output_events> outEvents) {
+		auto header = instance->get(eventPtr);
+		if (header.space_id != WCLAP_CORE_EVENT_SPACE_ID) return;
+		if (header.type == WCLAP_EVENT_PARAM_VALUE) {
+			auto event = instance->get(eventPtr.cast<const wclap_event_param_value>());
+			// Cookies are the parameter index + 1
+			int32_t index = paramIndex(event.param_id);
+			if (event.cookie) {
+				++stats.cookieEvents;
+				if (int32_t(event.cookie.wasmPointer) - 1 != index) ++stats.cookieMismatches;
+			}
+			if (index >= 0 && uint32_t(index) < plugin->values.size()) plugin->values[index] = event.value;
+			++stats.paramEvents;
+		} else if (header.type == WCLAP_EVENT_NOTE_ON || header.type == WCLAP_EVENT_NOTE_OFF) {
+			++stats.noteEvents;
+			if (outEvents) {
+				instance->call(instance->get(outEvents[&wclap_output_events::try_push]), outEvents, eventPtr);
+			}
+		}
+	}
+	void pushOutputEvent(Plugin *plugin, Pointer<const wclap_output_events> outEvents) {
+		instance->call(instance->get(outEvents[&wclap_output_events::try_push]), outEvents, plugin->outputEvent.cast<const wclap_event_header>());
+	}
+	void pushParamValue(Plugin *plugin, Pointer<const wclap_output_events> outEvents, wclap_id id, double value) {
+		wclap_event_param_value event{};
+		event.header = {.size=sizeof(event), .time=0, .space_id=WCLAP_CORE_EVENT_SPACE_ID, .type=WCLAP_EVENT_PARAM_VALUE, .flags=0};
+		event.param_id = id;
+		event.note_id = -1;
+		event.port_index = event.channel = event.key = -1;
+		event.value = value;
+		instance->set(plugin->outputEvent, event);
+		pushOutputEvent(plugin, outEvents);
+	}
+	void pushGesture(Plugin *plugin, Pointer<const wclap_output_events> outEvents, wclap_id id, uint16_t type) {
+		wclap_event_param_gesture event{};
+		event.header = {.size=sizeof(event), .time=0, .space_id=WCLAP_CORE_EVENT_SPACE_ID, .type=type, .flags=0};
+		event.param_id = id;
+		instance->set(plugin->outputEvent.cast<wclap_event_param_gesture>(), event);
+		pushOutputEvent(plugin, outEvents);
+	}
+	void handleEvents(Plugin *plugin, Pointer<const wclap_input_events> inEvents, Pointer<const wclap_output_events> outEvents, uint32_t frames=UINT32_MAX) {
+		if (!inEvents) return;
+		auto events = instance->get(inEvents);
+		uint32_t count = instance->call(events.size, inEvents);
+		for (uint32_t i = 0; i < count; ++i) {
+			auto eventPtr = instance->call(events.get, inEvents, i);
+			if (instance->get(eventPtr[&wclap_event_header::time]) >= frames) ++stats.lateEvents;
+			handleEvent(plugin, eventPtr, outEvents);
+		}
+	}
+
+	Instance::EntryPtr setUp(Instance &instance) {
+		this->instance = &instance;
+		using PluginPtr = Pointer<const wclap_plugin>;
+
+		// Descriptor
+		wclap_plugin_descriptor descriptor{};
+		descriptor.wclap_version = {1, 2, 7};
+		descriptor.id = writeString(config.pluginId);
+		descriptor.name = writeString("Fake Plugin");
+		descriptor.vendor = writeString("Signalsmith Audio");
+		descriptor.description = writeString("Native stand-in for benchmarking the host");
+		auto features = alloc<Pointer<const char>>(3);
+		instance.set(features, writeString("audio-effect"), 0);
+		instance.set(features, writeString("instrument"), 1);
+		instance.set(features, Pointer<const char>{0}, 2);
+		descriptor.features = features;
+		descriptorPtr = copy(descriptor);
+
+		// Extensions
+		wclap_plugin_audio_ports audioPorts{};
+		audioPorts.count = fn<uint32_t, PluginPtr, bool>([](PluginPtr, bool) -> uint32_t {
+			return 1;
+		});
+		audioPorts.get = fn<bool, PluginPtr, uint32_t, bool, Pointer<wclap_audio_port_info>>([this](PluginPtr, uint32_t index, bool, Pointer<wclap_audio_port_info> infoPtr) {
+			if (index != 0) return false;
+			wclap_audio_port_info info{};
+			info.id = 0;
+			std::snprintf(info.name, sizeof(info.name), "main");
+			info.flags = 1; // CLAP_AUDIO_PORT_IS_MAIN
+			info.channel_count = config.channels;
+			info.port_type = {0};
+			info.in_place_pair = 0;
+			this->instance->set(infoPtr, info);
+			return true;
+		});
+		audioPortsPtr = copy(audioPorts);
+
+		wclap_plugin_note_ports notePorts{};
+		notePorts.count = fn<uint32_t, PluginPtr, bool>([](PluginPtr, bool isInput) -> uint32_t {
+			return isInput ? 1 : 0;
+		});
+		notePorts.get = fn<bool, PluginPtr, uint32_t, bool, Pointer<wclap_note_port_info>>([this](PluginPtr, uint32_t index, bool isInput, Pointer<wclap_note_port_info> infoPtr) {
+			if (index != 0 || !isInput) return false;
+			wclap_note_port_info info{};
+			info.id = 0;
+			info.supported_dialects = 1; // CLAP_NOTE_DIALECT_CLAP
+			info.preferred_dialect = 1;
+			std::snprintf(info.name, sizeof(info.name), "notes");
+			this->instance->set(infoPtr, info);
+			return true;
+		});
+		notePortsPtr = copy(notePorts);
+
+		wclap_plugin_params params{};
+		params.count = fn<uint32_t, PluginPtr>([this](PluginPtr) {
+			MainThreadCall call{*this};
+			return config.paramCount;
+		});
+		params.get_info = fn<bool, PluginPtr, uint32_t, Pointer<wclap_param_info>>([this](PluginPtr, uint32_t index, Pointer<wclap_param_info> infoPtr) {
+			MainThreadCall call{*this};
+			if (index >= config.paramCount) return false;
+			wclap_param_info info{};
+			info.id = firstParamId + index;
+			info.flags = 0;
+			info.cookie = {index + 1};
+			std::snprintf(info.name, sizeof(info.name), "Param %u", index);
+			std::snprintf(info.module, sizeof(info.module), "fake/params");
+			info.min_value = 0;
+			info.max_value = 1;
+			info.default_value = 0.5;
+			this->instance->set(infoPtr, info);
+			return true;
+		});
+		params.get_value = fn<bool, PluginPtr, wclap_id, Pointer<double>>([this](PluginPtr pluginPtr, wclap_id id, Pointer<double> valuePtr) {
+			MainThreadCall call{*this};
+			auto index = paramIndex(id);
+			if (index < 0) return false;
+			this->instance->set(valuePtr, getPlugin(pluginPtr)->values[index]);
+			return true;
+		});
+		params.value_to_text = fn<bool, PluginPtr, wclap_id, double, Pointer<char>, uint32_t>([this](PluginPtr, wclap_id id, double value, Pointer<char> textPtr, uint32_t capacity) {
+			MainThreadCall call{*this};
+			if (paramIndex(id) < 0 || !capacity) return false;
+			char text[64];
+			auto length = std::snprintf(text, sizeof(text), "%.3f", value);
+			length = std::min<int>(length, int(capacity) - 1);
+			text[length] = 0;
+			this->instance->setArray(textPtr, text, length + 1);
+			return true;
+		});
+		params.text_to_value = fn<bool, PluginPtr, wclap_id, Pointer<const char>, Pointer<double>>([this](PluginPtr, wclap_id id, Pointer<const char> textPtr, Pointer<double> valuePtr) {
+			if (paramIndex(id) < 0) return false;
+			this->instance->set(valuePtr, std::strtod(readString(textPtr).c_str(), nullptr));
+			return true;
+		});
+		params.flush = fn<void, PluginPtr, Pointer<const wclap_input_events>, Pointer<const wclap_output_events>>([this](PluginPtr pluginPtr, Pointer<const wclap_input_events> inEvents, Pointer<const wclap_output_events> outEvents) {
+			handleEvents(getPlugin(pluginPtr), inEvents, outEvents);
+		});
+		paramsPtr = copy(params);
+
+		wclap_plugin_state state{};
+		state.save = fn<bool, PluginPtr, Pointer<const wclap_ostream>>([this](PluginPtr pluginPtr, Pointer<const wclap_ostream> ostream) {
+			MainThreadCall call{*this};
+			auto *plugin = getPlugin(pluginPtr);
+			++stats.stateSaves;
+			if (stateSaveDelayMs) std::this_thread::sleep_for(std::chrono::milliseconds(stateSaveDelayMs.load()));
+			// Parameter values, then filler up to `stateBytes`
+			auto &bytes = plugin->state;
+			bytes.resize(std::max<size_t>(config.stateBytes, plugin->values.size()*sizeof(double)));
+			std::memcpy(bytes.data(), plugin->values.data(), plugin->values.size()*sizeof(double));
+			for (size_t i = plugin->values.size()*sizeof(double); i < bytes.size(); ++i) bytes[i] = (unsigned char)((i*31)>>4);
+
+			auto write = this->instance->get(ostream[&wclap_ostream::write]);
+			size_t pos = 0;
+			while (pos < bytes.size()) {
+				auto length = std::min<size_t>(streamChunk, bytes.size() - pos);
+				this->instance->setArray(plugin->streamBuffer, bytes.data() + pos, length);
+				int64_t written = this->instance->call(write, ostream, plugin->streamBuffer.cast<const void>(), uint64_t(length));
+				if (written <= 0) return false;
+				pos += size_t(written);
+			}
+			return true;
+		});
+		state.load = fn<bool, PluginPtr, Pointer<const wclap_istream>>([this](PluginPtr pluginPtr, Pointer<const wclap_istream> istream) {
+			MainThreadCall call{*this};
+			auto *plugin = getPlugin(pluginPtr);
+			++stats.stateLoads;
+			auto &bytes = plugin->state;
+			bytes.clear();
+			auto read = this->instance->get(istream[&wclap_istream::read]);
+			while (true) {
+				int64_t length = this->instance->call(read, istream, plugin->streamBuffer.cast<void>(), uint64_t(streamChunk));
+				if (length < 0) return false;
+				if (length == 0) break;
+				auto start = bytes.size();
+				bytes.resize(start + size_t(length));
+				this->instance->getArray(plugin->streamBuffer, bytes.data() + start, size_t(length));
+			}
+			if (bytes.size() < plugin->values.size()*sizeof(double)) return false;
+			std::memcpy(plugin->values.data(), bytes.data(), plugin->values.size()*sizeof(double));
+			return true;
+		});
+		statePtr = copy(state);
+
+		wclap_plugin_tail tail{};
+		tail.get = fn<uint32_t, PluginPtr>([](PluginPtr) -> uint32_t {
+			return 0;
+		});
+		tailPtr = copy(tail);
+
+		// Plugin methods, shared between all plugin instances
+		wclap_plugin &plugin = pluginTemplate;
+		plugin = {};
+		plugin.desc = descriptorPtr;
+		plugin.init = fn<bool, PluginPtr>([](PluginPtr) {
+			return true;
+		});
+		plugin.destroy = fn<void, PluginPtr>([this](PluginPtr pluginPtr) {
+			MainThreadCall call{*this};
+			getPlugin(pluginPtr)->alive = false;
+		});
+		plugin.activate = fn<bool, PluginPtr, double, uint32_t, uint32_t>([this](PluginPtr pluginPtr, double, uint32_t, uint32_t maxFrames) {
+			getPlugin(pluginPtr)->audio.resize(maxFrames);
+			return true;
+		});
+		plugin.deactivate = fn<void, PluginPtr>([](PluginPtr) {});
+		plugin.start_processing = fn<bool, PluginPtr>([](PluginPtr) {
+			return true;
+		});
+		plugin.stop_processing = fn<void, PluginPtr>([](PluginPtr) {});
+		plugin.reset = fn<void, PluginPtr>([](PluginPtr) {});
+		plugin.process = fn<uint32_t, PluginPtr, Pointer<const wclap_process>>([this](PluginPtr pluginPtr, Pointer<const wclap_process> processPtr) -> uint32_t {
+			auto *plugin = getPlugin(pluginPtr);
+			auto process = this->instance->get(processPtr);
+			handleEvents(plugin, process.in_events, process.out_events, process.frames_count);
+			for (auto &param : outputParams) {
+				if (param.beginGesture) pushGesture(plugin, process.out_events, param.id, WCLAP_EVENT_PARAM_GESTURE_BEGIN);
+				pushParamValue(plugin, process.out_events, param.id, param.value);
+				if (param.endGesture) pushGesture(plugin, process.out_events, param.id, WCLAP_EVENT_PARAM_GESTURE_END);
+			}
+			outputParams.clear();
+
+			// Apply parameter 0 as gain
+			auto frames = std::min<uint32_t>(process.frames_count, uint32_t(plugin->audio.size()));
+			double gain = plugin->values.empty() ? 1 : plugin->values[0];
+			if (process.audio_inputs_count && process.audio_outputs_count) {
+				auto input = this->instance->get(process.audio_inputs);
+				auto output = this->instance->get(process.audio_outputs);
+				for (uint32_t c = 0; c < std::min(input.channel_count, output.channel_count); ++c) {
+					this->instance->getArray(this->instance->get(input.data32, c), plugin->audio.data(), frames);
+					for (uint32_t i = 0; i < frames; ++i) plugin->audio[i] *= float(gain);
+					this->instance->setArray(this->instance->get(output.data32, c), plugin->audio.data(), frames);
+				}
+			}
+			++stats.processCalls;
+			stats.processedFrames += frames;
+			return WCLAP_PROCESS_CONTINUE;
+		});
+		plugin.get_extension = fn<Pointer<const void>, PluginPtr, Pointer<const char>>([this](PluginPtr, Pointer<const char> idPtr) -> Pointer<const void> {
+			auto id = readString(idPtr);
+			if (id == "clap.audio-ports") return audioPortsPtr.cast<const void>();
+			if (id == "clap.note-ports") return notePortsPtr.cast<const void>();
+			if (id == "clap.params") return paramsPtr.cast<const void>();
+			if (id == "clap.state") return statePtr.cast<const void>();
+			if (id == "clap.tail") return tailPtr.cast<const void>();
+			return {0};
+		});
+		plugin.on_main_thread = fn<void, PluginPtr>([this](PluginPtr) {
+			MainThreadCall call{*this};
+		});
+
+		// Factory
+		wclap_plugin_factory factory{};
+		factory.get_plugin_count = fn<uint32_t, Pointer<const wclap_plugin_factory>>([](Pointer<const wclap_plugin_factory>) -> uint32_t {
+			return 1;
+		});
+		factory.get_plugin_descriptor = fn<Pointer<const wclap_plugin_descriptor>, Pointer<const wclap_plugin_factory>, uint32_t>([this](Pointer<const wclap_plugin_factory>, uint32_t index) -> Pointer<const wclap_plugin_descriptor> {
+			if (index != 0) return {0};
+			return descriptorPtr.cast<const wclap_plugin_descriptor>();
+		});
+		factory.create_plugin = fn<Pointer<const wclap_plugin>, Pointer<const wclap_plugin_factory>, Pointer<const wclap_host>, Pointer<const char>>([this](Pointer<const wclap_plugin_factory>, Pointer<const wclap_host> host, Pointer<const char> idPtr) -> Pointer<const wclap_plugin> {
+			if (readString(idPtr) != config.pluginId) return {0};
+			// Re-use destroyed plugins, since our memory is never freed
+			for (auto &plugin : plugins) {
+				if (plugin->alive) continue;
+				plugin->alive = true;
+				plugin->host = host;
+				plugin->values.assign(config.paramCount, 0.5);
+				return plugin->ptr.cast<const wclap_plugin>();
+			}
+			auto *plugin = new Plugin();
+			plugins.emplace_back(plugin);
+			plugin->host = host;
+			plugin->values.assign(config.paramCount, 0.5);
+			plugin->streamBuffer = alloc<unsigned char>(streamChunk);
+			plugin->outputEvent = alloc<wclap_event_param_value>();
+
+			auto wclapPlugin = pluginTemplate;
+			wclapPlugin.plugin_data = {uint32_t(plugins.size())};
+			plugin->ptr = copy(wclapPlugin);
+			return plugin->ptr.cast<const wclap_plugin>();
+		});
+		factoryPtr = copy(factory);
+
+		// Entry
+		wclap_plugin_entry entry{};
+		entry.wclap_version = {1, 2, 7};
+		entry.init = fn<bool, Pointer<const char>>([](Pointer<const char>) {
+			return true;
+		});
+		entry.deinit = fn<void>([](){});
+		entry.get_factory = fn<Pointer<const void>, Pointer<const char>>([this](Pointer<const char> idPtr) -> Pointer<const void> {
+			if (readString(idPtr) == "clap.plugin-factory") return factoryPtr.cast<const void>();
+			return {0};
+		});
+		entryPtr = copy(entry);
+		return entryPtr.cast<const wclap_plugin_entry>();
+	}
+};
+
+} // namespace
+
+using FakePlugin = impl32::FakePlugin;
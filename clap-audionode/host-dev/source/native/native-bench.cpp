@@ -0,0 +1,334 @@
+/* Microbenchmarks for the host's own overhead, using the fake plugin.
+
+Each result is one JSON object per line on stdout, e.g.:
+	{"bench":"process","block":128,"channels":2,"events":16,"iterations":51200,"nsPerOp":812.4}
+
+so that runs can be diffed/tracked over time (the host also logs to stdout, so only take lines starting with `{`).  Pass `--quick` for a shorter (noisier) run.*/
+
+#include "../common.h"
+#include "../cbor-bytes.h"
+#include "../event-queue.h"
+#include "../hosted-wclap.h"
+#include "../hosted-plugin.h"
+#include "../offline-render.h"
+#include "./fake-plugin.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+static double minSeconds = 0.2;
+
+struct Result {
+	std::string fields; // pre-formatted `"key":value` pairs
+	Result & add(const char *key, double value) {
+		char str[64];
+		std::snprintf(str, sizeof(str), "%s\"%s\":%.10g", fields.empty() ? "" : ",", key, value);
+		fields += str;
+		return *this;
+	}
+	Result & add(const char *key, const char *value) {
+		fields += std::string(fields.empty() ? "" : ",") + "\"" + key + "\":\"" + value + "\"";
+		return *this;
+	}
+	void print() {
+		std::printf("{%s}\n", fields.c_str());
+		std::fflush(stdout);
+	}
+};
+
+// Runs `fn()` in batches until `minSeconds` has passed, and returns the nanoseconds per call
+template<class Fn>
+static double timeOp(Fn &&fn, uint64_t &iterations) {
+	using Clock = std::chrono::steady_clock;
+	uint64_t batch = 1;
+	iterations = 0;
+	for (int i = 0; i < 3; ++i) fn(); // warm-up
+	auto start = Clock::now();
+	double elapsed = 0;
+	while (elapsed < minSeconds) {
+		for (uint64_t i = 0; i < batch; ++i) fn();
+		iterations += batch;
+		elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+		if (elapsed < minSeconds*0.1) batch *= 2;
+	}
+	return elapsed*1e9/double(iterations);
+}
+
+extern "C" {
+	HostedWclap * makeHosted(Instance *instance);
+	void removeHosted(HostedWclap *hosted);
+}
+
+struct Fixture {
+	FakePlugin::Config config;
+	Instance *instance;
+	HostedWclap *hosted;
+	HostedPlugin *plugin = nullptr;
+
+	Fixture(FakePlugin::Config config) : config(config) {
+		instance = new Instance(FakePlugin::entry(config));
+		hosted = makeHosted(instance);
+	}
+	~Fixture() {
+		if (plugin) {
+			plugin->stop();
+			delete plugin;
+		}
+		removeHosted(hosted);
+	}
+	HostedPlugin * create() {
+		return hosted->createPlugin(config.pluginId.c_str());
+	}
+	bool start(uint32_t maxFrames) {
+		plugin = create();
+		if (!plugin) return false;
+		std::vector<unsigned char> buffer;
+		CborWriter cbor{buffer};
+		return plugin->start(48000, 1, maxFrames, cbor);
+	}
+};
+
+static void benchProcess(uint32_t blockLength, uint32_t channels, uint32_t eventCount) {
+	FakePlugin::Config config;
+	config.channels = channels;
+	Fixture fixture(config);
+	if (!fixture.start(blockLength)) return;
+
+	wclap32::wclap_event_note note{};
+	note.header.size = sizeof(note);
+	note.header.space_id = wclap32::WCLAP_CORE_EVENT_SPACE_ID;
+	note.note_id = -1;
+	note.key = 60;
+	note.velocity = 1;
+
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		for (uint32_t e = 0; e < eventCount; ++e) {
+			note.header.time = uint32_t(uint64_t(e)*blockLength/eventCount);
+			note.header.type = (e&1) ? wclap32::WCLAP_EVENT_NOTE_OFF : wclap32::WCLAP_EVENT_NOTE_ON;
+			fixture.plugin->addEvent32(&note.header);
+		}
+		fixture.plugin->process(blockLength);
+	}, iterations);
+	Result().add("bench", "process").add("block", blockLength).add("channels", channels).add("events", eventCount)
+		.add("iterations", double(iterations)).add("nsPerOp", ns).add("nsPerFrame", ns/blockLength).print();
+}
+
+static void benchSetParam(uint32_t blockLength) {
+	Fixture fixture({});
+	if (!fixture.start(blockLength)) return;
+	double value = 0;
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		value = (value < 1) ? value + 0.01 : 0;
+		fixture.plugin->setParam(FakePlugin::firstParamId, value);
+		fixture.plugin->paramsFlush();
+	}, iterations);
+	Result().add("bench", "setParam+paramsFlush").add("iterations", double(iterations)).add("nsPerOp", ns).print();
+}
+
+static void benchGetParams(uint32_t paramCount) {
+	FakePlugin::Config config;
+	config.paramCount = paramCount;
+	Fixture fixture(config);
+	if (!fixture.start(128)) return;
+	std::vector<unsigned char> buffer;
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		buffer.clear();
+		CborWriter cbor{buffer};
+		fixture.plugin->getParams(cbor);
+	}, iterations);
+	Result().add("bench", "getParams").add("params", paramCount).add("iterations", double(iterations)).add("nsPerOp", ns).add("nsPerParam", ns/paramCount).print();
+}
+
+static void benchState(uint32_t stateBytes, bool compress) {
+	FakePlugin::Config config;
+	config.stateBytes = stateBytes;
+	Fixture fixture(config);
+	if (!fixture.start(128)) return;
+	fixture.plugin->compressState = compress;
+	std::vector<unsigned char> saved;
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		saved.clear();
+		fixture.plugin->saveState(saved);
+	}, iterations);
+	Result().add("bench", "saveState").add("bytes", stateBytes).add("compressed", compress ? 1 : 0).add("savedBytes", double(saved.size()))
+		.add("iterations", double(iterations)).add("nsPerOp", ns).add("nsPerByte", ns/stateBytes).print();
+	ns = timeOp([&](){
+		fixture.plugin->loadState(saved);
+	}, iterations);
+	Result().add("bench", "loadState").add("bytes", stateBytes).add("compressed", compress ? 1 : 0)
+		.add("iterations", double(iterations)).add("nsPerOp", ns).add("nsPerByte", ns/stateBytes).print();
+}
+
+// Undo-style history: a snapshot after each small edit
+static void benchSnapshots(uint32_t stateBytes, uint32_t editCount) {
+	FakePlugin::Config config;
+	config.stateBytes = stateBytes;
+	Fixture fixture(config);
+	if (!fixture.start(128)) return;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < editCount; ++i) {
+		fixture.plugin->setParam(FakePlugin::firstParamId + (i%config.paramCount), double(i)/editCount);
+		fixture.plugin->paramsFlush();
+		fixture.plugin->saveSnapshot();
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	auto stats = fixture.plugin->stateSnapshots.stats();
+	Result().add("bench", "saveSnapshot").add("bytes", stateBytes).add("snapshots", double(stats.snapshots))
+		.add("storedBytes", double(stats.storedBytes)).add("snapshotBytes", double(stats.snapshotBytes)).add("nsPerOp", seconds*1e9/editCount).print();
+}
+
+// Bypass/sample-rate toggling: the audio layout is kept between cycles
+static void benchStopStart(uint32_t channels) {
+	FakePlugin::Config config;
+	config.channels = channels;
+	Fixture fixture(config);
+	if (!fixture.start(512)) return;
+	std::vector<unsigned char> buffer;
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		fixture.plugin->stop();
+		buffer.clear();
+		CborWriter cbor{buffer};
+		fixture.plugin->start(48000, 1, 512, cbor);
+	}, iterations);
+	Result().add("bench", "stop+start").add("channels", channels).add("layoutBuilds", double(fixture.plugin->audioLayoutBuilds))
+		.add("iterations", double(iterations)).add("nsPerOp", ns).print();
+}
+
+// Offline rendering of `seconds` of audio, reported as a multiple of realtime (with a check that the output is right)
+static void benchOfflineRender(uint32_t blockLength, uint32_t channels, double seconds) {
+	FakePlugin::Config config;
+	config.channels = channels;
+	Fixture fixture(config);
+	if (!fixture.start(blockLength)) return;
+	fixture.plugin->setParam(FakePlugin::firstParamId, 0.5);
+	fixture.plugin->paramsFlush();
+
+	uint64_t length = uint64_t(seconds*48000);
+	std::vector<float> input(length*channels);
+	for (size_t i = 0; i < input.size(); ++i) input[i] = float(i%256);
+	OfflineRender render(*fixture.plugin);
+	auto result = render.renderInterleaved(input.data(), channels, length, nullptr, 0, 0);
+
+	bool correct = result.frames == length && result.outputs.size() == channels;
+	for (uint32_t c = 0; correct && c < channels; ++c) {
+		for (uint64_t i = 0; correct && i < length; ++i) correct = result.outputs[c][i] == input[i*channels + c]*0.5f;
+	}
+	Result().add("bench", "renderOffline").add("block", blockLength).add("channels", channels).add("seconds", seconds)
+		.add("realtime", result.realtimeFactor).add("nsPerFrame", result.seconds*1e9/double(length)).print();
+	if (!correct) {
+		std::fprintf(stderr, "offline render output is wrong\n");
+		std::exit(1);
+	}
+}
+
+static void benchCreateDestroy() {
+	Fixture fixture({});
+	uint64_t iterations;
+	double ns = timeOp([&](){
+		delete fixture.create();
+	}, iterations);
+	Result().add("bench", "createPlugin+destroy").add("iterations", double(iterations)).add("nsPerOp", ns).print();
+}
+
+static void benchCreateWarm() {
+	Fixture fixture({});
+	fixture.hosted->setWarmPoolSize(fixture.config.pluginId, 1);
+	using Clock = std::chrono::steady_clock;
+	double seconds = 0;
+	uint64_t iterations = 0;
+	while (seconds < minSeconds && iterations < 1000) { // the refill (untimed) dominates, so limit the count instead
+		fixture.hosted->refillWarmPools(1);
+		auto start = Clock::now();
+		auto *plugin = fixture.create();
+		seconds += std::chrono::duration<double>(Clock::now() - start).count();
+		delete plugin;
+		++iterations;
+	}
+	auto stats = fixture.hosted->warmPoolStats();
+	Result().add("bench", "createPlugin(warm)").add("iterations", double(iterations)).add("hits", double(stats.hits)).add("misses", double(stats.misses))
+		.add("nsPerOp", seconds*1e9/double(iterations)).print();
+}
+
+// Producer/consumer stress-test for the SPSC event queue: checks nothing is lost, reordered or corrupted
+static void benchEventQueue(uint64_t eventCount) {
+	impl32::EventQueue queue(4096);
+	struct Event {
+		wclap32::wclap_event_header header;
+		uint64_t sequence;
+		uint64_t padding[4];
+	};
+	std::atomic<bool> done{false};
+	uint64_t received = 0, errors = 0, pushFailures = 0;
+
+	auto start = std::chrono::steady_clock::now();
+	std::thread producer([&](){
+		Event event{};
+		for (uint64_t i = 0; i < eventCount; ++i) {
+			event.sequence = i;
+			// Vary the size, so the wrap-around gets exercised at different offsets
+			event.header.size = uint32_t(sizeof(wclap32::wclap_event_header) + 8 + 8*(i%5));
+			while (!queue.push(&event.header)) {
+				++pushFailures;
+				std::this_thread::yield();
+			}
+		}
+		done = true;
+	});
+	auto drain = [&](){
+		return queue.drain([&](const wclap32::wclap_event_header *header){
+			Event event;
+			std::memcpy(&event, header, header->size);
+			if (event.sequence != received || event.header.size != sizeof(wclap32::wclap_event_header) + 8 + 8*(received%5)) ++errors;
+			++received;
+		});
+	};
+	while (!done) {
+		if (!drain()) std::this_thread::yield();
+	}
+	producer.join();
+	drain();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	Result().add("bench", "eventQueue").add("events", double(eventCount)).add("received", double(received)).add("errors", double(errors))
+		.add("fullRetries", double(pushFailures)).add("nsPerEvent", seconds*1e9/double(eventCount)).print();
+	if (errors || received != eventCount) {
+		std::fprintf(stderr, "event queue stress-test failed\n");
+		std::exit(1);
+	}
+}
+
+int main(int argc, char **argv) {
+	for (int i = 1; i < argc; ++i) {
+		if (!std::strcmp(argv[i], "--quick")) minSeconds = 0.02;
+	}
+
+	benchEventQueue(minSeconds > 0.1 ? 2000000 : 100000);
+	for (uint32_t channels : {1, 2, 8}) {
+		for (uint32_t blockLength : {32, 128, 512, 4096}) {
+			for (uint32_t events : {0, 16, 256}) {
+				benchProcess(blockLength, channels, events);
+			}
+		}
+	}
+	benchSetParam(128);
+	benchGetParams(1000);
+	benchState(1024*1024, false);
+	benchState(1024*1024, true);
+	benchSnapshots(1024*1024, 50);
+	benchStopStart(2);
+	benchStopStart(8);
+	for (uint32_t blockLength : {128, 4096}) {
+		benchOfflineRender(blockLength, 2, minSeconds > 0.1 ? 60 : 5);
+	}
+	benchCreateDestroy();
+	benchCreateWarm();
+}
@@ -0,0 +1,813 @@
+/* Runs the host's exported API against the fake plugin, in-process.
+
+This is a smoke-test for the native build: it goes through the same lifecycle as the JS side (create, start, params, process, state, stop, destroy) and fails loudly if anything doesn't work.*/
+
+#include "../common.h"
+#include "../cbor-bytes.h"
+#include "../event-queue.h"
+#include "../graph-scheduler.h"
+#include "../hosted-wclap.h"
+#include "../hosted-plugin.h"
+#include "../plugin-graph.h"
+#include "../resource-cache.h"
+#include "../offline-render.h"
+#include "../state-snapshots.h"
+#include "./fake-plugin.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+	HostedWclap * makeHosted(Instance *instance);
+	void removeHosted(HostedWclap *hosted);
+	void getInfo(HostedWclap *hosted, Bytes *bytes);
+	void getMemoryStats(HostedWclap *hosted, Bytes *bytes);
+	HostedPlugin * createPlugin(HostedWclap *hosted, Bytes *bytes);
+	void setWarmPoolSize(HostedWclap *hosted, Bytes *bytes, uint32_t size);
+	uint32_t refillWarmPools(HostedWclap *hosted, uint32_t maxCount);
+	bool destroyPlugin(HostedPlugin *plugin);
+	void pluginGetParams(HostedPlugin *plugin, Bytes *bytes);
+	void pluginSetParam(HostedPlugin *plugin, uint32_t paramId, double value);
+	const void * pluginGetParamValue(HostedPlugin *plugin, uint32_t paramId, bool withText);
+	uint32_t pluginSetParams(HostedPlugin *plugin, Bytes *bytes, uint32_t count);
+	uint32_t pluginPollParams(HostedPlugin *plugin, Bytes *bytes);
+	void pluginParamsFlush(HostedPlugin *plugin);
+	bool pluginSetEventBudget(HostedPlugin *plugin, uint32_t bytes);
+	bool pluginStart(HostedPlugin *plugin, double sRate, uint32_t minFrames, uint32_t maxFrames, Bytes *bytes);
+	bool pluginBindAudio(HostedPlugin *plugin, bool isOutput, uint32_t port, uint32_t channel, uint32_t instancePtr);
+	uint32_t pluginBoundAudio(HostedPlugin *plugin, bool isOutput, uint32_t port, uint32_t channel);
+	bool pluginBindInPlace(HostedPlugin *plugin, uint32_t outputPort);
+	void pluginStop(HostedPlugin *plugin);
+	bool pluginSaveState(HostedPlugin *plugin, Bytes *bytes);
+	bool pluginLoadState(HostedPlugin *plugin, Bytes *bytes);
+	void pluginSetStateCompression(HostedPlugin *plugin, bool compress);
+	uint32_t pluginSaveStateAsync(HostedPlugin *plugin);
+	uint32_t pluginLoadStateAsync(HostedPlugin *plugin, Bytes *bytes);
+	int32_t pluginStateRequestStatus(HostedPlugin *plugin, uint32_t requestId);
+	bool pluginFinishStateRequest(HostedPlugin *plugin, uint32_t requestId, Bytes *bytes);
+	uint32_t pluginProcess(HostedPlugin *plugin, uint32_t blockLength);
+	PluginGraph * createGraph(HostedWclap *hosted);
+	void destroyGraph(PluginGraph *graph);
+	int32_t graphAddPlugin(PluginGraph *graph, HostedPlugin *plugin);
+	bool graphConnectAudio(PluginGraph *graph, uint32_t fromNode, uint32_t fromPort, uint32_t toNode, uint32_t toPort);
+	bool graphConnectEvents(PluginGraph *graph, uint32_t fromNode, uint32_t toNode);
+	void graphSetThreads(PluginGraph *graph, uint32_t threadCount, double deadlineSeconds);
+	bool graphCompile(PluginGraph *graph, uint32_t maxFrames);
+	uint32_t graphProcess(PluginGraph *graph, uint32_t blockLength);
+}
+
+static int failures = 0;
+#define CHECK(expr) \
+	if (!(expr)) { \
+		std::fprintf(stderr, "FAILED: %s (%s:%i)\n", #expr, __FILE__, __LINE__); \
+		++failures; \
+	}
+
+int main() {
+	// Event queue, with a real producer thread: everything arrives once, in order and intact, with the ring wrapping at varying offsets
+	{
+		impl32::EventQueue queue(1024);
+		struct Event {
+			wclap32::wclap_event_header header;
+			uint64_t sequence;
+			uint64_t payload[6];
+		};
+		constexpr uint64_t eventCount = 200000;
+		auto eventSize = [](uint64_t i){
+			return uint32_t(sizeof(wclap32::wclap_event_header) + 8 + 8*(i%7));
+		};
+		std::atomic<bool> done{false};
+		uint64_t pushFailures = 0;
+		std::thread producer([&](){
+			Event event{};
+			for (uint64_t i = 0; i < eventCount; ++i) {
+				event.header.size = eventSize(i);
+				event.header.time = uint32_t(i);
+				event.sequence = i;
+				for (auto &p : event.payload) p = i*31 + 7;
+				while (!queue.push(&event.header)) {
+					++pushFailures;
+					std::this_thread::yield();
+				}
+			}
+			done = true;
+		});
+		uint64_t received = 0, outOfOrder = 0, corrupt = 0;
+		auto drain = [&](){
+			return queue.drain([&](const wclap32::wclap_event_header *header){
+				Event event{};
+				std::memcpy(&event, header, std::min<size_t>(header->size, sizeof(event)));
+				if (event.sequence != received) ++outOfOrder;
+				size_t payloadCount = (header->size - sizeof(wclap32::wclap_event_header) - 8)/8;
+				bool intact = header->size == eventSize(event.sequence) && header->time == uint32_t(event.sequence);
+				for (size_t p = 0; p < payloadCount; ++p) intact = intact && event.payload[p] == event.sequence*31 + 7;
+				if (!intact) ++corrupt;
+				received = event.sequence + 1; // so one bad event is counted once, not for the rest of the run
+			});
+		};
+		uint64_t drained = 0;
+		while (!done) {
+			auto n = drain();
+			drained += n;
+			if (!n) std::this_thread::yield();
+		}
+		producer.join();
+		drained += drain();
+		CHECK(drained == eventCount && received == eventCount);
+		CHECK(outOfOrder == 0 && corrupt == 0);
+		CHECK(queue.overflowCount() == uint32_t(pushFailures));
+		CHECK(drain() == 0);
+	}
+
+	// Graph scheduler: dependencies respected and every task run once per quantum, independent tasks really run in parallel, and missed deadlines fall back to serial
+	{
+		using Clock = std::chrono::steady_clock;
+		// 0 -> {1, 2} -> 3, and 4 on its own
+		std::vector<std::vector<uint32_t>> dependents = {{1, 2}, {3}, {3}, {}, {}};
+		std::vector<uint32_t> serialOrder = {0, 1, 2, 3, 4};
+		std::atomic<uint32_t> counter{0};
+		std::atomic<uint32_t> runOrder[5], runCount[5];
+		GraphScheduler scheduler(2);
+		scheduler.setGraph(dependents, [&](uint32_t t){
+			runOrder[t] = counter++;
+			++runCount[t];
+		});
+		bool ordered = true, once = true;
+		for (int quantum = 0; quantum < 500; ++quantum) {
+			counter = 0;
+			for (auto &c : runCount) c = 0;
+			scheduler.run(serialOrder);
+			for (auto &c : runCount) once = once && c == 1;
+			ordered = ordered && runOrder[0] < runOrder[1] && runOrder[0] < runOrder[2] && runOrder[1] < runOrder[3] && runOrder[2] < runOrder[3];
+			if (quantum%100 == 0) std::this_thread::sleep_for(std::chrono::milliseconds(5)); // let the workers go to sleep
+		}
+		CHECK(ordered && once);
+		CHECK(scheduler.fallbackCount() == 0);
+
+		// Two independent tasks which each wait for the other to start: only finishes promptly if they overlap
+		std::atomic<int> started{0};
+		std::atomic<bool> overlapped{true};
+		GraphScheduler pair(1);
+		pair.setGraph({{}, {}}, [&](uint32_t){
+			++started;
+			auto until = Clock::now() + std::chrono::seconds(2);
+			while (started < 2) {
+				if (Clock::now() > until) {
+					overlapped = false;
+					return;
+				}
+				std::this_thread::yield();
+			}
+		});
+		std::this_thread::sleep_for(std::chrono::milliseconds(20)); // the worker is asleep, so this checks it's woken
+		pair.run({0, 1});
+		CHECK(overlapped && started == 2);
+
+		// A missed deadline means the next quanta run serially (in the given order)
+		bool missDeadline = false;
+		scheduler.setDeadlineCheck([&](GraphScheduler::Clock::duration){
+			return missDeadline;
+		});
+		scheduler.run(serialOrder);
+		CHECK(scheduler.fallbackCount() == 0);
+		missDeadline = true;
+		scheduler.run(serialOrder);
+		CHECK(scheduler.fallbackCount() == 0);
+		counter = 0;
+		scheduler.run(serialOrder);
+		scheduler.run(serialOrder);
+		CHECK(scheduler.fallbackCount() == 2);
+		for (uint32_t t = 0; t < 5; ++t) CHECK(runOrder[t] == 5 + t);
+	}
+
+	// State snapshots: every version round-trips, including after removing others - also with a hash which always collides, so the chunks share one probe sequence
+	for (auto hashFn : {StateSnapshots::HashFn(StateSnapshots::contentHash), StateSnapshots::HashFn([](const unsigned char *, size_t){return uint64_t(42);})}) {
+		StateSnapshots snapshots(hashFn);
+		std::vector<std::vector<unsigned char>> versions;
+		std::vector<unsigned char> state(100000);
+		uint64_t x = 12345;
+		for (auto &b : state) {
+			x = x*6364136223846793005ull + 1442695040888963407ull;
+			b = (unsigned char)(x>>56);
+		}
+		std::vector<uint32_t> ids;
+		for (size_t v = 0; v < 6; ++v) {
+			for (size_t i = 0; i < 50; ++i) state[v*15013 + i] ^= 0x5A; // a small edit each time
+			if (v == 3) state.resize(70000);
+			versions.push_back(state);
+			ids.push_back(snapshots.add(state.data(), state.size()));
+		}
+		auto roundTrips = [&](size_t v){
+			std::vector<unsigned char> buffer;
+			return snapshots.get(ids[v], buffer) && buffer == versions[v];
+		};
+		for (size_t v = 0; v < ids.size(); ++v) CHECK(roundTrips(v));
+		auto stats = snapshots.stats();
+		CHECK(stats.snapshots == 6 && stats.storedBytes < stats.snapshotBytes/2);
+
+		CHECK(snapshots.remove(ids[1]) && snapshots.remove(ids[4]) && !snapshots.remove(ids[4]));
+		for (size_t v : {0, 2, 3, 5}) CHECK(roundTrips(v));
+		// A copy of the latest version is stored entirely as references - its chunks are past the removed ones in any probe sequence
+		auto removed = snapshots.stats();
+		auto copyId = snapshots.add(versions[5].data(), versions[5].size());
+		CHECK(snapshots.stats().storedBytes == removed.storedBytes && snapshots.stats().chunks == removed.chunks);
+		CHECK(snapshots.remove(copyId));
+		// Re-adding the removed versions shares the chunks which are still there, so nothing is stored twice
+		ids[1] = snapshots.add(versions[1].data(), versions[1].size());
+		ids[4] = snapshots.add(versions[4].data(), versions[4].size());
+		for (size_t v = 0; v < ids.size(); ++v) CHECK(roundTrips(v));
+		auto readded = snapshots.stats();
+		CHECK(readded.chunks == stats.chunks && readded.storedBytes == stats.storedBytes);
+		for (auto id : ids) CHECK(snapshots.remove(id));
+		stats = snapshots.stats();
+		CHECK(stats.snapshots == 0 && stats.chunks == 0 && stats.storedBytes == 0 && stats.snapshotBytes == 0);
+	}
+
+	// Resource cache: size-bounded with the least-recently-used evicted first, and a fetch from before a flush can't put its result back
+	{
+		ResourceCache cache;
+		std::vector<unsigned char> kb(1000, 'x'), result;
+		auto generation = cache.generation();
+		for (auto path : {"/a", "/b", "/c"}) cache.put(path, kb, generation);
+		CHECK(cache.get("/a", result) && result == kb); // now "/b" is the oldest
+		cache.setMaxBytes(2500);
+		CHECK(!cache.get("/b", result) && cache.get("/a", result) && cache.get("/c", result));
+		cache.put("/d", kb, generation); // evicts "/a"
+		CHECK(!cache.get("/a", result) && cache.get("/c", result) && cache.get("/d", result));
+		cache.put("/huge", std::vector<unsigned char>(3000), generation); // bigger than the whole cache
+		CHECK(!cache.get("/huge", result) && cache.get("/c", result));
+
+		auto staleGeneration = cache.generation();
+		cache.flush();
+		CHECK(!cache.get("/c", result) && cache.generation() != staleGeneration);
+		cache.put("/c", kb, staleGeneration);
+		CHECK(!cache.get("/c", result));
+		cache.put("/c", kb, cache.generation());
+		CHECK(cache.get("/c", result) && result == kb);
+	}
+
+	constexpr uint32_t blockLength = 128;
+	FakePlugin::Config config;
+	std::shared_ptr<FakePlugin> module;
+	auto *instance = new Instance(FakePlugin::entry(config, &module));
+	auto *hosted = makeHosted(instance); // takes ownership of the Instance
+	Bytes bytes;
+
+	getInfo(hosted, &bytes);
+	CHECK(bytes.buffer.size() > 0);
+
+	// Host extensions: exact IDs only, and unsupported ones are counted
+	{
+		auto getExtension = [&](const std::string &id){
+			auto ptr = instance->malloc32(uint32_t(id.size() + 1)).cast<char>();
+			instance->setArray(ptr, id.c_str(), id.size() + 1);
+			return HostedWclap::hostGetExtension32(hosted, {0}, ptr.cast<const char>()).wasmPointer;
+		};
+		auto unsupported = hosted->unsupportedExtensionCount.load();
+		CHECK(getExtension("clap.params") == hosted->paramsExtPtr.wasmPointer && hosted->paramsExtPtr);
+		CHECK(getExtension("clap.webview/3") == hosted->webviewExtPtr.wasmPointer && hosted->webviewExtPtr);
+		CHECK(getExtension("clap.paramz") == 0 && getExtension("clap.params.x") == 0 && getExtension(std::string(300, 'x')) == 0);
+		CHECK(hosted->unsupportedExtensionCount == unsupported + 3);
+		CHECK(hosted->lastUnsupportedExtension() == std::string(255, 'x'));
+		hosted->logUnsupportedExtensions();
+		CHECK(hosted->loggedUnsupportedCount == hosted->unsupportedExtensionCount);
+	}
+
+	bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+	auto *plugin = createPlugin(hosted, &bytes);
+	CHECK(plugin);
+	if (!plugin) return 1;
+
+	CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+
+	// Parameter 0 is gain: a block of 1s should come out as 0.25s
+	pluginSetParam(plugin, FakePlugin::firstParamId, 0.25);
+	pluginParamsFlush(plugin);
+	for (uint32_t c = 0; c < config.channels; ++c) {
+		wclap32::Pointer<float> input{pluginBoundAudio(plugin, false, 0, c)};
+		CHECK(input);
+		for (uint32_t i = 0; i < blockLength; ++i) instance->set(input, 1.0f, i);
+	}
+	CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+	for (uint32_t c = 0; c < config.channels; ++c) {
+		wclap32::Pointer<float> output{pluginBoundAudio(plugin, true, 0, c)};
+		CHECK(output && instance->get(output, blockLength - 1) == 0.25f);
+	}
+
+	// Parameter events should carry the plugin's cookies
+	CHECK(module->stats.cookieEvents > 0);
+	CHECK(module->stats.cookieMismatches == 0);
+
+	// Batch set, and binary get
+	{
+		double values[2] = {0.75, 0.125};
+		uint32_t ids[2] = {FakePlugin::firstParamId + 1, FakePlugin::firstParamId + 2};
+		bytes.buffer.resize(sizeof(values) + sizeof(ids));
+		std::memcpy(bytes.buffer.data(), values, sizeof(values));
+		std::memcpy(bytes.buffer.data() + sizeof(values), ids, sizeof(ids));
+		CHECK(pluginSetParams(plugin, &bytes, 2) == 2);
+		pluginParamsFlush(plugin);
+		auto *result = (const HostedPlugin::ParamValueResult *)pluginGetParamValue(plugin, ids[1], true);
+		CHECK(result->flags == 3 && result->value == 0.125);
+		CHECK(std::string(result->text, result->textLength) == "0.125");
+		result = (const HostedPlugin::ParamValueResult *)pluginGetParamValue(plugin, 12345, true);
+		CHECK(result->flags == 0);
+	}
+
+	bytes.buffer.clear();
+	pluginGetParams(plugin, &bytes);
+	CHECK(bytes.buffer.size() > 0);
+
+	// State round-trip
+	bytes.buffer.clear();
+	CHECK(pluginSaveState(plugin, &bytes));
+	CHECK(bytes.buffer.size() >= config.stateBytes);
+	pluginSetParam(plugin, FakePlugin::firstParamId, 1);
+	pluginParamsFlush(plugin);
+	CHECK(pluginLoadState(plugin, &bytes));
+	CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+
+	// Compressed state: smaller, loads back, and corruption is caught
+	{
+		auto rawSize = bytes.buffer.size();
+		pluginSetStateCompression(plugin, true);
+		bytes.buffer.clear();
+		CHECK(pluginSaveState(plugin, &bytes));
+		CHECK(StateCodec::detect(bytes.buffer.data(), bytes.buffer.size()) == StateCodec::COMPRESSED && bytes.buffer.size() < rawSize);
+		pluginSetParam(plugin, FakePlugin::firstParamId, 1);
+		pluginParamsFlush(plugin);
+		CHECK(pluginLoadState(plugin, &bytes));
+		auto *result = (const HostedPlugin::ParamValueResult *)pluginGetParamValue(plugin, FakePlugin::firstParamId, false);
+		CHECK(result->value == 0.25);
+		bytes.buffer[bytes.buffer.size()/2] ^= 0x55;
+		CHECK(!pluginLoadState(plugin, &bytes));
+		// An envelope version we don't know is refused, without passing anything to the plugin
+		bytes.buffer[bytes.buffer.size()/2] ^= 0x55;
+		bytes.buffer[4] = StateCodec::version + 1;
+		auto stateLoads = module->stats.stateLoads;
+		CHECK(StateCodec::detect(bytes.buffer.data(), bytes.buffer.size()) == StateCodec::UNSUPPORTED);
+		CHECK(!pluginLoadState(plugin, &bytes) && module->stats.stateLoads == stateLoads);
+		pluginSetStateCompression(plugin, false);
+	}
+
+	// Background save/load, while the audio thread keeps going
+	{
+		auto waitFor = [&](uint32_t requestId){
+			int32_t status;
+			while ((status = pluginStateRequestStatus(plugin, requestId)) == HostedPlugin::stateRequestPending) {
+				CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+			}
+			return status;
+		};
+		auto requestId = pluginSaveStateAsync(plugin);
+		CHECK(requestId != 0 && waitFor(requestId) == HostedPlugin::stateRequestDone);
+		CHECK(pluginFinishStateRequest(plugin, requestId, &bytes) && bytes.buffer.size() >= config.stateBytes);
+		CHECK(pluginStateRequestStatus(plugin, requestId) == HostedPlugin::stateRequestUnknown);
+		pluginSetParam(plugin, FakePlugin::firstParamId, 1);
+		pluginParamsFlush(plugin);
+		requestId = pluginLoadStateAsync(plugin, &bytes);
+		CHECK(waitFor(requestId) == HostedPlugin::stateRequestDone);
+		CHECK(pluginFinishStateRequest(plugin, requestId, &bytes));
+		auto *result = (const HostedPlugin::ParamValueResult *)pluginGetParamValue(plugin, FakePlugin::firstParamId, false);
+		CHECK(result->value == 0.25);
+
+		// Main-thread calls made during a (slow) background save wait for it, rather than overlapping it
+		module->stateSaveDelayMs = 20;
+		requestId = pluginSaveStateAsync(plugin);
+		for (int i = 0; i < 5; ++i) {
+			plugin->paramsRescan(wclap32::WCLAP_PARAM_RESCAN_VALUES);
+			pluginGetParamValue(plugin, FakePlugin::firstParamId + i, true);
+			plugin->hostRequestCallback();
+			plugin->mainThread(); // skipped (and left requested) while the worker has the plugin
+		}
+		CHECK(waitFor(requestId) == HostedPlugin::stateRequestDone);
+		CHECK(pluginFinishStateRequest(plugin, requestId, &bytes));
+		CHECK(module->mainThreadOverlaps == 0);
+		module->stateSaveDelayMs = 0;
+
+		// Destroying a plugin waits for its background jobs
+		bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+		auto *busy = createPlugin(hosted, &bytes);
+		auto saves = module->stats.stateSaves;
+		module->stateSaveDelayMs = 20;
+		CHECK(busy && pluginSaveStateAsync(busy));
+		CHECK(destroyPlugin(busy));
+		CHECK(module->stats.stateSaves == saves + 1 && module->mainThreadOverlaps == 0);
+		module->stateSaveDelayMs = 0;
+	}
+
+	// Stop/start keeps the audio layout (and buffers), until the ports are rescanned
+	{
+		auto builds = plugin->audioLayoutBuilds;
+		auto input = pluginBoundAudio(plugin, false, 0, 0);
+		pluginStop(plugin);
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(plugin->audioLayoutBuilds == builds && pluginBoundAudio(plugin, false, 0, 0) == input);
+		pluginStop(plugin);
+		plugin->audioPortsRescan(wclap32::WCLAP_AUDIO_PORTS_RESCAN_LIST);
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(plugin->audioLayoutBuilds == builds + 1);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+	}
+
+	// `RESCAN_ALL` replaces the tracker on the next read (while deactivated), even with another thread setting parameters - and waits for `stop()` if the plugin is active
+	{
+		pluginStop(plugin);
+		std::atomic<bool> producing{true};
+		std::thread producer{[&](){
+			while (producing) pluginSetParam(plugin, FakePlugin::firstParamId + 3, 0.5);
+		}};
+		for (uint32_t count : {4u, 8u, 2u, 8u}) {
+			module->setParamCount(count);
+			plugin->paramsRescan(wclap32::WCLAP_PARAM_RESCAN_ALL);
+			CHECK(plugin->paramInfoStale);
+			plugin->refreshParamCache();
+			CHECK(plugin->paramTracker.size() == count && plugin->paramCache.size() == count);
+		}
+		producing = false;
+		producer.join();
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(plugin->paramTracker.cookie(FakePlugin::firstParamId + 7).wasmPointer == 8);
+
+		module->setParamCount(6);
+		plugin->paramsRescan(wclap32::WCLAP_PARAM_RESCAN_ALL);
+		plugin->refreshParamCache();
+		CHECK(plugin->paramTracker.size() == 8 && plugin->paramCache.size() == 8);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		pluginStop(plugin);
+		plugin->refreshParamCache();
+		CHECK(plugin->paramTracker.size() == 6 && plugin->paramCache.size() == 6);
+		module->setParamCount(8);
+		plugin->paramsRescan(wclap32::WCLAP_PARAM_RESCAN_ALL);
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(plugin->paramTracker.size() == 8);
+
+		// Events queued before the rescan reach the plugin without their (possibly freed) cookies - cleared by the audio thread, not the rescan
+		pluginStop(plugin);
+		pluginSetParam(plugin, FakePlugin::firstParamId + 1, 0.5);
+		auto cookieEvents = module->stats.cookieEvents, paramEvents = module->stats.paramEvents;
+		plugin->paramsRescan(wclap32::WCLAP_PARAM_RESCAN_ALL);
+		CHECK(plugin->paramCookiesStale);
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(!plugin->paramCookiesStale && module->stats.paramEvents == paramEvents + 1 && module->stats.cookieEvents == cookieEvents);
+	}
+
+	// Polling reports only the parameters the plugin changed since the last poll, with their latest values and gesture state
+	{
+		pluginPollParams(plugin, &bytes);
+		module->outputParams = {
+			{FakePlugin::firstParamId + 2, 0.1, true, false},
+			{FakePlugin::firstParamId + 2, 0.2},
+			{FakePlugin::firstParamId + 5, 0.7, true, true}
+		};
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(pluginPollParams(plugin, &bytes) == 2 && bytes.buffer.size() == 2*sizeof(HostedPlugin::PolledParam));
+		HostedPlugin::PolledParam polled[2];
+		std::memcpy(polled, bytes.buffer.data(), sizeof(polled));
+		CHECK(polled[0].id == FakePlugin::firstParamId + 2 && polled[0].value == 0.2 && polled[0].flags == 1);
+		CHECK(polled[1].id == FakePlugin::firstParamId + 5 && polled[1].value == 0.7 && polled[1].flags == 0);
+		CHECK(pluginPollParams(plugin, &bytes) == 0 && bytes.buffer.empty());
+
+		module->outputParams = {{FakePlugin::firstParamId + 2, 0.3, false, true}};
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(pluginPollParams(plugin, &bytes) == 1);
+		std::memcpy(polled, bytes.buffer.data(), sizeof(polled[0]));
+		CHECK(polled[0].id == FakePlugin::firstParamId + 2 && polled[0].value == 0.3 && polled[0].flags == 0);
+	}
+
+	// Binding caller-provided buffers: in-place (output aliasing input), rebinding to other buffers, and back to our own
+	{
+		std::vector<uint32_t> ownInputs, ownOutputs;
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			ownInputs.push_back(pluginBoundAudio(plugin, false, 0, c));
+			ownOutputs.push_back(pluginBoundAudio(plugin, true, 0, c));
+		}
+		CHECK(pluginBindInPlace(plugin, 0));
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			CHECK(pluginBoundAudio(plugin, true, 0, c) == ownInputs[c]);
+			wclap32::Pointer<float> buffer{ownInputs[c]};
+			for (uint32_t i = 0; i < blockLength; ++i) instance->set(buffer, float(i), i);
+		}
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			wclap32::Pointer<float> buffer{ownInputs[c]};
+			CHECK(instance->get(buffer, 0) == 0 && instance->get(buffer, blockLength - 1) == float(blockLength - 1)*0.25f);
+		}
+
+		// Separate external buffers for input/output channel 0 (channel 1 stays in-place)
+		auto external = instance->malloc32(uint32_t(sizeof(float)*blockLength*2)).cast<float>();
+		auto externalOut = external;
+		externalOut += blockLength;
+		CHECK(pluginBindAudio(plugin, false, 0, 0, external.wasmPointer) && pluginBindAudio(plugin, true, 0, 0, externalOut.wasmPointer));
+		CHECK(pluginBoundAudio(plugin, false, 0, 0) == external.wasmPointer && pluginBoundAudio(plugin, true, 0, 0) == externalOut.wasmPointer);
+		wclap32::Pointer<float> ownOutput{ownOutputs[0]};
+		instance->set(ownOutput, -1.0f, 0);
+		for (uint32_t i = 0; i < blockLength; ++i) instance->set(external, 2.0f, i);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(instance->get(externalOut, 0) == 0.5f && instance->get(external, 0) == 2.0f);
+		CHECK(instance->get(ownOutput, 0) == -1.0f);
+
+		// Out-of-range ports/channels are refused, and don't change anything
+		CHECK(!pluginBindAudio(plugin, true, 1, 0, external.wasmPointer) && !pluginBindAudio(plugin, true, 0, config.channels, external.wasmPointer));
+		CHECK(!pluginBindInPlace(plugin, 1));
+		CHECK(pluginBoundAudio(plugin, true, 1, 0) == 0 && pluginBoundAudio(plugin, true, 0, config.channels) == 0);
+
+		// Binding 0 goes back to our own buffers
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			CHECK(pluginBindAudio(plugin, false, 0, c, 0) && pluginBindAudio(plugin, true, 0, c, 0));
+			CHECK(pluginBoundAudio(plugin, false, 0, c) == ownInputs[c] && pluginBoundAudio(plugin, true, 0, c) == ownOutputs[c]);
+		}
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			wclap32::Pointer<float> buffer{ownInputs[c]};
+			for (uint32_t i = 0; i < blockLength; ++i) instance->set(buffer, 1.0f, i);
+		}
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			wclap32::Pointer<float> input{ownInputs[c]}, output{ownOutputs[c]};
+			CHECK(instance->get(input, 0) == 1.0f && instance->get(output, 0) == 0.25f);
+		}
+	}
+
+	// Events due after this block are held back (with their times moved along), and delivered on time
+	wclap32::wclap_event_note note{};
+	note.header.size = sizeof(note);
+	note.header.space_id = wclap32::WCLAP_CORE_EVENT_SPACE_ID;
+	note.header.type = wclap32::WCLAP_EVENT_NOTE_ON;
+	note.note_id = -1;
+	note.key = 60;
+	note.velocity = 1;
+	{
+		auto notes = module->stats.noteEvents;
+		note.header.time = blockLength;
+		CHECK(plugin->addEvent32(&note.header));
+		note.header.time = blockLength*2 + 5;
+		CHECK(plugin->addEvent32(&note.header));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(module->stats.noteEvents == notes && plugin->pendingEventStarts.size() == 2);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(module->stats.noteEvents == notes + 1);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(module->stats.noteEvents == notes + 2 && plugin->pendingEventStarts.empty());
+		CHECK(module->stats.lateEvents == 0);
+	}
+
+	// Splitting at ramp points: each sub-block only sees its own events (with sub-block times), so a stepped gain ramp comes out as steps
+	{
+		constexpr uint32_t step = 32;
+		auto processCalls = module->stats.processCalls;
+		plugin->setRampOptions(step, true);
+		CHECK(plugin->rampParam(FakePlugin::firstParamId, 0, 1, 0, blockLength, 0));
+		// A note in a later sub-block, whose echo should come out at its time within the whole block
+		note.header.time = step*2 + 3;
+		CHECK(plugin->addEvent32(&note.header));
+		std::vector<unsigned char> captured;
+		plugin->outputEventCapture = &captured;
+		wclap32::Pointer<float> input{pluginBoundAudio(plugin, false, 0, 0)};
+		for (uint32_t i = 0; i < blockLength; ++i) instance->set(input, 1.0f, i);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		plugin->outputEventCapture = nullptr;
+		CHECK(module->stats.processCalls == processCalls + blockLength/step);
+		CHECK(captured.size() >= sizeof(note));
+		auto *echoed = (const wclap32::wclap_event_header *)captured.data();
+		CHECK(echoed->type == wclap32::WCLAP_EVENT_NOTE_ON && echoed->time == step*2 + 3);
+		wclap32::Pointer<float> output{pluginBoundAudio(plugin, true, 0, 0)};
+		for (uint32_t i = 0; i < blockLength; i += step/2) {
+			CHECK(instance->get(output, i) == float(i/step*step)/blockLength);
+		}
+		CHECK(module->stats.lateEvents == 0);
+		// The ramp ends exactly at the next block boundary, so its last value is at time 0 and there's no split
+		processCalls = module->stats.processCalls;
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(module->stats.processCalls == processCalls + 1 && instance->get(output, 0) == 1.0f);
+		plugin->setRampOptions(16, false);
+		pluginSetParam(plugin, FakePlugin::firstParamId, 0.25);
+		pluginParamsFlush(plugin);
+	}
+
+	// Held events are bounded by the event budget too: ones which don't fit are dropped (and counted), rather than allocated for
+	{
+		auto &stats = plugin->eventTransferStats;
+		CHECK(!pluginSetEventBudget(plugin, 4096)); // not while active
+		pluginStop(plugin);
+		CHECK(pluginSetEventBudget(plugin, 4096));
+		CHECK(pluginStart(plugin, 48000, 1, blockLength, &bytes));
+		CHECK(plugin->audioScratch.capacity == 4096 && plugin->stagedEventBytes.capacity() < 8192);
+		auto notes = module->stats.noteEvents;
+		uint64_t batch = plugin->heldEventBytes()/sizeof(note);
+		note.header.time = blockLength*2;
+		for (uint64_t i = 0; i < batch; ++i) CHECK(plugin->addEvent32(&note.header));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(stats.heldDropped == 0 && plugin->pendingEventStarts.size() == batch);
+		note.header.time = blockLength;
+		for (uint64_t i = 0; i < batch; ++i) CHECK(plugin->addEvent32(&note.header));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		uint64_t held = plugin->pendingEventStarts.size();
+		CHECK(stats.heldDropped > 0 && stats.heldDropped + held == 2*batch);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(module->stats.noteEvents == notes + held);
+		CHECK(stats.scratchOverflows == 0 && stats.blockBytes <= plugin->audioScratch.capacity);
+		CHECK(plugin->pendingEventBytes.capacity() == plugin->heldEventBytes());
+
+		// So are a block's staged events: 64 ramps with an event every frame are more than the scratch holds, so some are dropped (and counted) without allocating
+		auto stagedCapacity = plugin->stagedEventBytes.capacity(), copiedCapacity = plugin->copiedInputEventPtrs.capacity();
+		auto overflows = stats.scratchOverflows.load(), dropped = stats.scratchDropped.load();
+		plugin->setRampOptions(1, false);
+		for (uint32_t i = 0; i < plugin->paramRamps.size(); ++i) {
+			CHECK(plugin->rampParam(5000 + i, 0, 1, 0, blockLength, 0));
+		}
+		// One more ramp than there are slots is dropped (and counted) too
+		auto rampsDropped = stats.rampsDropped.load();
+		CHECK(plugin->rampParam(6000, 0, 1, 0, blockLength, 0));
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+		CHECK(stats.scratchOverflows == overflows + 1 && stats.scratchDropped > dropped);
+		CHECK(stats.rampsDropped == rampsDropped + 1);
+		CHECK(stats.blockBytes <= plugin->audioScratch.capacity);
+		CHECK(plugin->stagedEventBytes.capacity() == stagedCapacity && plugin->copiedInputEventPtrs.capacity() == copiedCapacity);
+		CHECK(pluginProcess(plugin, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE); // the ramps' final values
+		CHECK(stats.scratchOverflows == overflows + 1);
+		plugin->setRampOptions(16, false);
+	}
+
+	pluginStop(plugin);
+	destroyPlugin(plugin);
+
+	// Warm pool: pre-created plugins are handed out first
+	bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+	setWarmPoolSize(hosted, &bytes, 2);
+	CHECK(refillWarmPools(hosted, 10) == 2);
+	CHECK(refillWarmPools(hosted, 10) == 0);
+	for (int i = 0; i < 3; ++i) {
+		bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+		auto *warmPlugin = createPlugin(hosted, &bytes);
+		CHECK(warmPlugin && pluginStart(warmPlugin, 48000, 1, blockLength, &bytes));
+		destroyPlugin(warmPlugin);
+	}
+	{
+		auto stats = hosted->warmPoolStats();
+		CHECK(stats.hits == 2 && stats.misses == 1);
+	}
+
+	// Offline rendering: the whole input comes out (processed), and output events have absolute times
+	{
+		bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+		auto *offline = createPlugin(hosted, &bytes);
+		CHECK(offline && pluginStart(offline, 48000, 1, blockLength, &bytes));
+		pluginSetParam(offline, FakePlugin::firstParamId, 0.5);
+		pluginParamsFlush(offline);
+
+		constexpr uint64_t length = 48000 + 77; // not a whole number of blocks
+		std::vector<std::vector<float>> inputs(config.channels, std::vector<float>(length));
+		std::vector<const float *> inputPtrs;
+		for (uint32_t c = 0; c < config.channels; ++c) {
+			for (uint64_t i = 0; i < length; ++i) inputs[c][i] = float(i%1000) + c;
+			inputPtrs.push_back(inputs[c].data());
+		}
+		std::vector<unsigned char> events;
+		uint32_t noteTimes[3] = {5, blockLength*3 + 1, uint32_t(length - 1)};
+		for (auto time : noteTimes) {
+			note.header.time = time;
+			auto offset = events.size();
+			events.resize(offset + sizeof(note)); // already a multiple of `EventQueue::alignment`
+			std::memcpy(events.data() + offset, &note, sizeof(note));
+			if (time == noteTimes[0]) { // followed by an event too big to pass on
+				offset = events.size();
+				events.resize(offset + OfflineRender::maxEventBytes + 64);
+				wclap32::wclap_event_header big{.size=OfflineRender::maxEventBytes + 64, .time=time, .space_id=0x1234, .type=0, .flags=0};
+				std::memcpy(events.data() + offset, &big, sizeof(big));
+			}
+		}
+
+		OfflineRender render(*offline);
+		auto result = render.renderPlanar(inputPtrs.data(), config.channels, length, events.data(), events.size(), 0);
+		CHECK(result.status == wclap32::WCLAP_PROCESS_CONTINUE && result.frames == length);
+		CHECK(result.droppedEvents == 1);
+		CHECK(result.outputs.size() == config.channels && result.realtimeFactor > 0);
+		bool correct = true;
+		for (uint32_t c = 0; c < result.outputs.size(); ++c) {
+			correct = correct && result.outputs[c].size() == length;
+			for (uint64_t i = 0; correct && i < length; ++i) correct = result.outputs[c][i] == inputs[c][i]*0.5f;
+		}
+		CHECK(correct);
+		size_t eventCount = 0;
+		for (size_t offset = 0; offset + sizeof(wclap32::wclap_event_header) <= result.outputEvents.size(); ++eventCount) {
+			auto *event = (const wclap32::wclap_event_header *)(result.outputEvents.data() + offset);
+			CHECK(eventCount < 3 && event->time == noteTimes[eventCount]);
+			offset += (event->size + impl32::EventQueue::alignment - 1)&~(impl32::EventQueue::alignment - 1);
+		}
+		CHECK(eventCount == 3);
+
+		// Interleaved input gives the same result
+		std::vector<float> interleaved(length*config.channels);
+		for (uint64_t i = 0; i < length; ++i) {
+			for (uint32_t c = 0; c < config.channels; ++c) interleaved[i*config.channels + c] = inputs[c][i];
+		}
+		auto interleavedResult = render.renderInterleaved(interleaved.data(), config.channels, length, nullptr, 0, 0);
+		CHECK(interleavedResult.frames == length && interleavedResult.outputs == result.outputs);
+		// Event times are 32-bit, so longer renders are rejected before processing anything
+		auto tooLong = render.renderInterleaved(nullptr, 0, OfflineRender::maxFrames32 + 1, nullptr, 0, 0);
+		CHECK(tooLong.status == wclap32::WCLAP_PROCESS_ERROR && tooLong.frames == 0);
+		pluginStop(offline);
+		CHECK(destroyPlugin(offline));
+	}
+
+	// Graphs: topological order, duplicate connections, lock-free event fan-in, and plugin lifetimes
+	{
+		HostedPlugin *chain[3]; // processed in this order, with gains 0.5, 0.5, 0.5
+		for (auto *&p : chain) {
+			bytes.buffer.assign(config.pluginId.begin(), config.pluginId.end());
+			p = createPlugin(hosted, &bytes);
+			CHECK(p && pluginStart(p, 48000, 1, blockLength, &bytes));
+			pluginSetParam(p, FakePlugin::firstParamId, 0.5);
+			pluginParamsFlush(p);
+		}
+		auto *a = chain[0], *b = chain[1], *c = chain[2];
+
+		// Cycles are rejected, and destroying the graph releases its plugins
+		auto *graph = createGraph(hosted);
+		CHECK(graphAddPlugin(graph, a) == 0 && graphAddPlugin(graph, b) == 1);
+		CHECK(graphAddPlugin(graph, a) == -1); // already in a graph
+		CHECK(graphConnectAudio(graph, 0, 0, 1, 0) && graphConnectAudio(graph, 1, 0, 0, 0));
+		CHECK(!graphConnectAudio(graph, 0, 0, 0, 0) && !graphConnectAudio(graph, 0, 0, 2, 0));
+		CHECK(!graphCompile(graph, blockLength));
+		CHECK(graphProcess(graph, blockLength) == wclap32::WCLAP_PROCESS_ERROR);
+		CHECK(!destroyPlugin(a)); // still in the graph
+		destroyGraph(graph);
+		CHECK(!a->graph && !b->graph && a->eventTargets.empty() && b->eventSources.empty());
+
+		// Added in reverse order, so the graph has to sort them: a -> b -> c
+		graph = createGraph(hosted);
+		CHECK(graphAddPlugin(graph, c) == 0 && graphAddPlugin(graph, b) == 1 && graphAddPlugin(graph, a) == 2);
+		CHECK(graphConnectAudio(graph, 2, 0, 1, 0) && graphConnectAudio(graph, 1, 0, 0, 0));
+		CHECK(graphConnectAudio(graph, 2, 0, 1, 0)); // duplicate: accepted, but not mixed in twice
+		// Events: a -> c and b -> c (fan-in), with a duplicate
+		CHECK(graphConnectEvents(graph, 2, 0) && graphConnectEvents(graph, 1, 0) && graphConnectEvents(graph, 2, 0));
+		CHECK(graphCompile(graph, blockLength));
+		CHECK(a->eventTargets.size() == 1 && b->eventTargets.size() == 1 && c->eventSources.size() == 2);
+		CHECK(pluginBoundAudio(b, false, 0, 0) == pluginBoundAudio(a, true, 0, 0));
+
+		auto runChain = [&](float inputValue){
+			for (uint32_t ch = 0; ch < config.channels; ++ch) {
+				wclap32::Pointer<float> input{pluginBoundAudio(a, false, 0, ch)};
+				for (uint32_t i = 0; i < blockLength; ++i) instance->set(input, inputValue, i);
+			}
+			CHECK(graphProcess(graph, blockLength) == wclap32::WCLAP_PROCESS_CONTINUE);
+			for (uint32_t ch = 0; ch < config.channels; ++ch) {
+				wclap32::Pointer<float> output{pluginBoundAudio(c, true, 0, ch)};
+				CHECK(instance->get(output, 0) == inputValue*0.125f && instance->get(output, blockLength - 1) == inputValue*0.125f);
+			}
+		};
+		runChain(1);
+		runChain(2); // fresh values each block, so a stale (out-of-order) result can't pass
+		graphSetThreads(graph, 2, 1.0);
+		CHECK(graphCompile(graph, blockLength));
+		runChain(4);
+		runChain(5);
+
+		// One note into each of a and b: each echoes it to c, so c sees two
+		auto notes = module->stats.noteEvents;
+		note.header.time = 10;
+		CHECK(a->addEvent32(&note.header) && b->addEvent32(&note.header));
+		runChain(1);
+		CHECK(module->stats.noteEvents == notes + 4);
+		CHECK(module->stats.lateEvents == 0);
+
+		// Plugins can't be destroyed while they're in a graph, so the graph never sees a dangling pointer
+		CHECK(!destroyPlugin(b));
+		runChain(3);
+		destroyGraph(graph);
+		CHECK(pluginBoundAudio(b, false, 0, 0) != pluginBoundAudio(a, true, 0, 0));
+		for (auto *p : chain) {
+			pluginStop(p);
+			CHECK(destroyPlugin(p));
+		}
+	}
+
+	// Memory accounting: everything the plugins kept has been given back
+	{
+		auto &accounting = hosted->arenaAccounting;
+		auto &pluginArenas = accounting.kept[ArenaAccounting::KEPT_PLUGIN];
+		CHECK(pluginArenas.arenas.current == 0 && pluginArenas.bytes.current == 0);
+		CHECK(pluginArenas.arenas.highWater >= 2 && pluginArenas.bytes.highWater > 0);
+		CHECK(accounting.kept[ArenaAccounting::KEPT_MESSAGE].arenas.current == 0);
+		CHECK(accounting.scopes.current == 0 && accounting.scopeCount > 0);
+		CHECK(accounting.arenas.current == accounting.kept[ArenaAccounting::KEPT_GLOBAL].arenas.current + accounting.kept[ArenaAccounting::KEPT_STREAM].arenas.current);
+		getMemoryStats(hosted, &bytes);
+		CHECK(bytes.buffer.size() > 0);
+	}
+	removeHosted(hosted);
+
+	if (failures) {
+		std::fprintf(stderr, "%i checks failed\n", failures);
+		return 1;
+	}
+	std::printf("native host: OK\n");
+	return 0;
+}
@@ -0,0 +1,24 @@
+/* Native stand-ins for the functions which `host.wasm` imports from JS.
+
+There's no JS side to forward anything to, so these just accept and drop everything.*/
+
+#include <cstdint>
+
+bool pluginOutputEventsTryPush32(const void *plugin, uint32_t remotePtr, uint32_t length) {
+	return true;
+}
+bool pluginWebviewSend(const void *plugin, uint32_t remotePtr, uint32_t length) {
+	return true;
+}
+bool pluginStateMarkDirty(const void *plugin) {
+	return true;
+}
+bool pluginParamsRescan(const void *plugin, uint32_t flags) {
+	return true;
+}
+int32_t pluginStateWrite(const void *plugin, uint32_t remotePtr, uint32_t length) {
+	return int32_t(length);
+}
+int32_t pluginStateRead(const void *plugin, uint32_t remotePtr, uint32_t maxLength) {
+	return 0;
+}
@@ -0,0 +1,123 @@
+/* In-process `Instance`, for building the host natively (see `WCLAP_HOST_NATIVE` in `CMakeLists.txt`).
+
+The "WASM" memory is a fixed-size flat byte array, and function pointers are indices into a table of C++ callables.  The module itself is a C++ function which sets up its structures in that memory and returns the entry pointer (e.g. `FakePlugin` in `fake-plugin.h`).
+
+This only implements the parts of the `Instance` API which the host uses.*/
+
+#pragma once
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+struct Instance {
+	using EntryPtr = wclap32::Pointer<const wclap32::wclap_plugin_entry>;
+	using EntryInit = std::function<EntryPtr(Instance &)>;
+
+	Instance(EntryInit entryInit, const char *path="/native", size_t memoryBytes=256*1024*1024) : entryInit(entryInit), pathString(path), memorySize(memoryBytes), memory(new unsigned char[memoryBytes]()) {
+		functions.emplace_back(nullptr); // index 0 is the null function
+	}
+
+	EntryPtr entry32 = {0};
+
+	bool is64() const {
+		return false;
+	}
+	const char * path() const {
+		return pathString.c_str();
+	}
+	void init() {
+		if (entryInit) entry32 = entryInit(*this);
+	}
+
+	// Bump allocator - there's no `free()`, the same as a WASM module which only grows its memory
+	wclap32::Pointer<void> malloc32(uint32_t size) {
+		size_t start = memoryEnd.load();
+		size_t aligned;
+		do {
+			aligned = (start + 15)&~size_t(15);
+			if (aligned + size > memorySize) {
+				std::fprintf(stderr, "native Instance: out of memory (%u bytes requested)\n", size);
+				std::abort();
+			}
+		} while (!memoryEnd.compare_exchange_weak(start, aligned + size));
+		return {uint32_t(aligned)};
+	}
+
+	template<class T>
+	std::remove_const_t<T> get(wclap32::Pointer<T> ptr, size_t index=0) {
+		std::remove_const_t<T> value;
+		std::memcpy((void *)&value, address(ptr, index), sizeof(T));
+		return value;
+	}
+	template<class T>
+	void set(wclap32::Pointer<T> ptr, const std::remove_const_t<T> &value, size_t index=0) {
+		std::memcpy(address(ptr, index), (const void *)&value, sizeof(T));
+	}
+	template<class T>
+	void getArray(wclap32::Pointer<T> ptr, std::remove_const_t<T> *values, size_t count) {
+		std::memcpy((void *)values, address(ptr, 0, count), count*sizeof(T));
+	}
+	template<class T>
+	void setArray(wclap32::Pointer<T> ptr, const std::remove_const_t<T> *values, size_t count) {
+		std::memcpy(address(ptr, 0, count), (const void *)values, count*sizeof(T));
+	}
+	template<class T>
+	uint32_t countUntil(wclap32::Pointer<T> ptr, const std::remove_const_t<T> &value, uint32_t maxCount) {
+		for (uint32_t i = 0; i < maxCount; ++i) {
+			if (!std::memcmp(address(ptr, i), (const void *)&value, sizeof(T))) return i;
+		}
+		return maxCount;
+	}
+
+	// Function table
+	template<class R, class... A>
+	wclap32::Function<R, A...> registerFunction32(typename std::common_type<std::function<R(A...)>>::type fn) { // non-deduced, so it accepts lambdas
+		functions.emplace_back(std::make_shared<std::function<R(A...)>>(std::move(fn)));
+		return {uint32_t(functions.size() - 1)};
+	}
+	template<class R, class... A>
+	wclap32::Function<R, A...> registerHost32(void *context, R (*fn)(void *, A...)) {
+		return registerFunction32<R, A...>([context, fn](A... args) -> R {
+			return fn(context, args...);
+		});
+	}
+	template<class R, class... A, class... Args>
+	R call(wclap32::Function<R, A...> fn, Args... args) {
+		if (!fn.wasmPointer || fn.wasmPointer >= functions.size()) {
+			std::fprintf(stderr, "native Instance: invalid function pointer %u\n", fn.wasmPointer);
+			std::abort();
+		}
+		auto *callable = (std::function<R(A...)> *)functions[fn.wasmPointer].get();
+		return (*callable)(A(args)...);
+	}
+	template<class F, class... Args>
+	auto call(wclap32::Pointer<F> fnPtr, Args... args) {
+		return call(get(fnPtr), args...);
+	}
+
+	// Direct access, for native modules
+	template<class T>
+	T * address(wclap32::Pointer<T> ptr, size_t index=0, size_t count=1) {
+		size_t offset = size_t(ptr.wasmPointer) + index*sizeof(T);
+		if (!ptr.wasmPointer || offset + count*sizeof(T) > memorySize) {
+			std::fprintf(stderr, "native Instance: invalid access at %u\n", ptr.wasmPointer);
+			std::abort();
+		}
+		return (T *)(memory.get() + offset);
+	}
+
+private:
+	EntryInit entryInit;
+	std::string pathString;
+	size_t memorySize;
+	std::unique_ptr<unsigned char[]> memory;
+	std::atomic<size_t> memoryEnd{16}; // so that nothing gets allocated at 0
+	std::vector<std::shared_ptr<void>> functions; // each is a `std::function<R(A...)>`, with the type from its `wclap32::Function<R, A...>`
+};
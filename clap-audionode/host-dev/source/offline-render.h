@@ -0,0 +1,171 @@
+#pragma once
+
+#include "./common.h"
+#include "./hosted-plugin.h"
+
+#include <chrono>
+#include <vector>
+
+namespace impl32 {
+using namespace wclap32;
+
+/* Pushes audio + events through a started `HostedPlugin` as fast as possible, in blocks of up to `maxFrames`.
+
+Input/output channels are flattened across ports, in port order.  Events are packed `wclap_event_header`s (each aligned to `EventQueue::alignment`) with absolute frame times, in time order.  Output events are returned in the same format.  Input events bigger than `maxEventBytes` (or than the plugin's event queue can hold) are dropped, and counted in `Result::droppedEvents`.
+
+Since event times are 32-bit, a render (including its tail) is limited to `maxFrames32` frames - about 24 hours at 48kHz.  Longer inputs are rejected, and the tail is cut off at the limit.
+
+After the input ends, it keeps processing silence according to the plugin's process status: until `CLAP_PROCESS_SLEEP`, the end of a reported tail, quiet output (for `CONTINUE_IF_NOT_QUIET`), or `maxTailFrames`.*/
+struct OfflineRender {
+	struct Result {
+		uint32_t status = WCLAP_PROCESS_ERROR; // from the last block
+		uint64_t frames = 0;
+		std::vector<std::vector<float>> outputs;
+		std::vector<unsigned char> outputEvents;
+		uint64_t droppedEvents = 0;
+		double seconds = 0;
+		double realtimeFactor = 0;
+	};
+
+	static constexpr uint64_t maxFrames32 = uint64_t(1) << 32;
+	static constexpr uint32_t maxEventBytes = 512;
+
+	HostedPlugin &plugin;
+	float quietThreshold = 1e-6f; // mean-square level, for `CONTINUE_IF_NOT_QUIET`
+
+	OfflineRender(HostedPlugin &plugin) : plugin(plugin) {}
+
+	Result renderPlanar(const float * const *inputs, uint32_t inputChannels, uint64_t length, const unsigned char *events, size_t eventBytes, uint64_t maxTailFrames) {
+		return render(length, events, eventBytes, maxTailFrames, [&](uint32_t channel, uint64_t offset, float *buffer, uint32_t frames){
+			if (channel < inputChannels) {
+				std::memcpy(buffer, inputs[channel] + offset, frames*sizeof(float));
+			} else {
+				std::fill(buffer, buffer + frames, 0.0f);
+			}
+		});
+	}
+	Result renderInterleaved(const float *input, uint32_t inputChannels, uint64_t length, const unsigned char *events, size_t eventBytes, uint64_t maxTailFrames) {
+		return render(length, events, eventBytes, maxTailFrames, [&](uint32_t channel, uint64_t offset, float *buffer, uint32_t frames){
+			if (channel < inputChannels) {
+				auto *frame = input + offset*inputChannels + channel;
+				for (uint32_t i = 0; i < frames; ++i) buffer[i] = frame[i*inputChannels];
+			} else {
+				std::fill(buffer, buffer + frames, 0.0f);
+			}
+		});
+	}
+
+private:
+	template<class FillInput>
+	Result render(uint64_t length, const unsigned char *events, size_t eventBytes, uint64_t maxTailFrames, FillInput &&fillInput) {
+		Result result;
+		auto *instance = plugin.instance;
+		uint32_t maxFrames = plugin.activeMaxFrames;
+		if (!plugin.processStructPtr || !maxFrames || length > maxFrames32) return result;
+		
+		uint32_t inputCount = 0, outputCount = 0;
+		for (auto &port : plugin.inputPorts) inputCount += port.channelCount;
+		for (auto &port : plugin.outputPorts) outputCount += port.channelCount;
+		auto channelPtr = [&](bool isOutput, uint32_t index) {
+			for (auto &port : (isOutput ? plugin.outputPorts : plugin.inputPorts)) {
+				if (index < port.channelCount) return plugin.audioChannels[port.firstChannel + index].buffer;
+				index -= port.channelCount;
+			}
+			return Pointer<float>{0};
+		};
+		result.outputs.resize(outputCount);
+		for (auto &output : result.outputs) output.reserve(length);
+		std::vector<float> buffer(maxFrames);
+
+		plugin.outputEventCapture = &result.outputEvents;
+		bool prevToJs = plugin.outputEventsToJs;
+		plugin.outputEventsToJs = false;
+		
+		auto startTime = std::chrono::steady_clock::now();
+		size_t eventOffset = 0;
+		uint64_t pos = 0, tailEnd = length + std::min(maxTailFrames, maxFrames32 - length);
+		while (pos < tailEnd) {
+			uint32_t blockLength = uint32_t(std::min<uint64_t>(maxFrames, tailEnd - pos));
+			if (pos < length) blockLength = uint32_t(std::min<uint64_t>(blockLength, length - pos));
+			
+			// Queue this block's events - if the queue fills up, the block ends early
+			while (eventOffset + sizeof(wclap_event_header) <= eventBytes) {
+				wclap_event_header header;
+				std::memcpy(&header, events + eventOffset, sizeof(header));
+				if (header.size < sizeof(header) || eventOffset + header.size > eventBytes) {
+					eventOffset = eventBytes; // malformed
+					break;
+				}
+				if (header.time >= pos + blockLength) break;
+				alignas(EventQueue::alignment) unsigned char eventCopy[maxEventBytes];
+				if (header.size <= sizeof(eventCopy)) {
+					std::memcpy(eventCopy, events + eventOffset, header.size);
+					auto *event = (wclap_event_header *)eventCopy;
+					event->time = (header.time > pos) ? uint32_t(header.time - pos) : 0;
+					if (!plugin.addEvent32(event)) {
+						if (event->time > 0) {
+							blockLength = event->time;
+							break;
+						}
+						// Even an empty queue can't hold this event, so drop it
+						++result.droppedEvents;
+					}
+				} else {
+					++result.droppedEvents;
+				}
+				eventOffset += (header.size + EventQueue::alignment - 1)&~(EventQueue::alignment - 1);
+			}
+			
+			for (uint32_t c = 0; c < inputCount; ++c) {
+				if (pos < length) {
+					fillInput(c, pos, buffer.data(), blockLength);
+				} else {
+					std::fill(buffer.begin(), buffer.begin() + blockLength, 0.0f);
+				}
+				instance->setArray(channelPtr(false, c), buffer.data(), blockLength);
+			}
+
+			size_t eventsBefore = result.outputEvents.size();
+			result.status = plugin.process(blockLength);
+			// Make the new output events' times absolute (which can't wrap, because `pos + blockLength <= maxFrames32`)
+			for (size_t offset = eventsBefore; offset < result.outputEvents.size();) {
+				while (offset%EventQueue::alignment) ++offset;
+				auto *event = (wclap_event_header *)(result.outputEvents.data() + offset);
+				event->time += uint32_t(pos);
+				offset += event->size;
+			}
+			
+			double energy = 0;
+			for (uint32_t c = 0; c < outputCount; ++c) {
+				instance->getArray(channelPtr(true, c), buffer.data(), blockLength);
+				auto &output = result.outputs[c];
+				output.insert(output.end(), buffer.begin(), buffer.begin() + blockLength);
+				for (uint32_t i = 0; i < blockLength; ++i) energy += buffer[i]*buffer[i];
+			}
+			pos += blockLength;
+			
+			if (result.status == WCLAP_PROCESS_ERROR) break;
+			if (pos < length) continue;
+			// Input has ended, so we stop as soon as the plugin says it can
+			if (result.status == WCLAP_PROCESS_SLEEP) break;
+			if (result.status == WCLAP_PROCESS_CONTINUE_IF_NOT_QUIET && energy <= quietThreshold*blockLength*std::max<uint32_t>(outputCount, 1)) break;
+			if (result.status == WCLAP_PROCESS_TAIL && plugin.tailExtPtr) {
+				auto tail = plugin.callPlugin(plugin.tailExtPtr[&wclap_plugin_tail::get]);
+				if (tail != uint32_t(-1)) tailEnd = std::min<uint64_t>(tailEnd, length + tail);
+			}
+		}
+		
+		result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+		result.frames = pos;
+		if (result.seconds > 0 && plugin.activeSampleRate > 0) {
+			result.realtimeFactor = (pos/plugin.activeSampleRate)/result.seconds;
+		}
+		plugin.outputEventCapture = nullptr;
+		plugin.outputEventsToJs = prevToJs;
+		return result;
+	}
+};
+
+} // namespace
+
+using OfflineRender = impl32::OfflineRender;
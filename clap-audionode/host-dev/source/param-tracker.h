@@ -0,0 +1,138 @@
+#pragma once
+
+#include "./common.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace impl32 {
+using namespace wclap32;
+
+/* Current parameter values (and gesture state), with a dirty bit for each parameter.  It also holds each parameter's cookie, for stamping on the events we send.
+
+The plugin's output events update this from the audio thread, and a single poller (e.g. the UI at 60Hz) collects only the values which changed since it last asked.  Parameters are referred to by index, in the order the plugin listed them.
+
+The ID list is fixed between `reset()`s, which must only happen while nothing else is using it (the host only resets while the plugin is deactivated, with event producers locked out).  Everything else is lock-free and safe from any thread.*/
+struct ParamTracker {
+	size_t size() const {
+		return count;
+	}
+
+	// Only call while no other thread is using this (e.g. the plugin isn't processing)
+	void reset(const std::vector<wclap_id> &ids) {
+		count = ids.size();
+		this->ids = ids;
+		sortedIds.clear();
+		for (size_t i = 0; i < count; ++i) sortedIds.emplace_back(ids[i], uint32_t(i));
+		std::sort(sortedIds.begin(), sortedIds.end());
+		values.reset(new std::atomic<double>[count]);
+		cookies.reset(new std::atomic<uint32_t>[count]);
+		for (size_t i = 0; i < count; ++i) {
+			values[i].store(0, std::memory_order_relaxed);
+			cookies[i].store(0, std::memory_order_relaxed);
+		}
+		size_t words = (count + 63)/64;
+		dirtyBits.reset(new std::atomic<uint64_t>[words]);
+		gestureBits.reset(new std::atomic<uint64_t>[words]);
+		for (size_t w = 0; w < words; ++w) {
+			dirtyBits[w].store(0, std::memory_order_relaxed);
+			gestureBits[w].store(0, std::memory_order_relaxed);
+		}
+	}
+	bool hasIds(const std::vector<wclap_id> &ids) const {
+		if (ids.size() != count) return false;
+		for (size_t i = 0; i < count; ++i) {
+			if (indexOf(ids[i]) != int32_t(i)) return false;
+		}
+		return true;
+	}
+
+	int32_t indexOf(wclap_id id) const {
+		auto iter = std::lower_bound(sortedIds.begin(), sortedIds.end(), std::make_pair(id, uint32_t(0)));
+		if (iter == sortedIds.end() || iter->first != id) return -1;
+		return int32_t(iter->second);
+	}
+	wclap_id idAt(uint32_t index) const {
+		return ids[index];
+	}
+
+	// Null if the ID is unknown, or the cookies have been cleared
+	Pointer<void> cookie(wclap_id id) const {
+		auto index = indexOf(id);
+		if (index < 0) return {0};
+		return {cookies[index].load(std::memory_order_relaxed)};
+	}
+	void setCookie(uint32_t index, Pointer<void> cookie) {
+		cookies[index].store(cookie.wasmPointer, std::memory_order_relaxed);
+	}
+	void clearCookies() {
+		for (size_t i = 0; i < count; ++i) cookies[i].store(0, std::memory_order_relaxed);
+	}
+
+	double value(uint32_t index) const {
+		return values[index].load(std::memory_order_relaxed);
+	}
+	bool gesture(uint32_t index) const {
+		return gestureBits[index/64].load(std::memory_order_relaxed)&(uint64_t(1)<<(index%64));
+	}
+	// Host-side changes (which the poller doesn't need to hear about)
+	void store(uint32_t index, double value) {
+		values[index].store(value, std::memory_order_relaxed);
+	}
+	// Changes reported by the plugin
+	void changed(uint32_t index, double value) {
+		values[index].store(value, std::memory_order_relaxed);
+		markDirty(index);
+	}
+	void setGesture(uint32_t index, bool active) {
+		uint64_t bit = uint64_t(1)<<(index%64);
+		if (active) {
+			gestureBits[index/64].fetch_or(bit, std::memory_order_relaxed);
+		} else {
+			gestureBits[index/64].fetch_and(~bit, std::memory_order_relaxed);
+		}
+		markDirty(index);
+	}
+
+	// Single poller only: calls `fn(index, value, gesture)` for each parameter changed since the last poll
+	template<class Fn>
+	size_t poll(Fn &&fn) {
+		size_t changedCount = 0;
+		for (size_t w = 0; w*64 < count; ++w) {
+			if (!dirtyBits[w].load(std::memory_order_relaxed)) continue;
+			uint64_t bits = dirtyBits[w].exchange(0, std::memory_order_acquire);
+			while (bits) {
+				uint32_t index = uint32_t(w*64) + countTrailingZeros(bits);
+				bits &= bits - 1;
+				fn(index, value(index), gesture(index));
+				++changedCount;
+			}
+		}
+		return changedCount;
+	}
+
+private:
+	size_t count = 0;
+	std::vector<wclap_id> ids;
+	std::vector<std::pair<wclap_id, uint32_t>> sortedIds;
+	std::unique_ptr<std::atomic<double>[]> values;
+	std::unique_ptr<std::atomic<uint32_t>[]> cookies;
+	std::unique_ptr<std::atomic<uint64_t>[]> dirtyBits, gestureBits;
+
+	void markDirty(uint32_t index) {
+		dirtyBits[index/64].fetch_or(uint64_t(1)<<(index%64), std::memory_order_release);
+	}
+	static uint32_t countTrailingZeros(uint64_t bits) {
+		uint32_t n = 0;
+		while (!(bits&1)) {
+			bits >>= 1;
+			++n;
+		}
+		return n;
+	}
+};
+
+} // namespace
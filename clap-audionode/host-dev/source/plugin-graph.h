@@ -0,0 +1,240 @@
+#pragma once
+
+#include "./common.h"
+#include "./hosted-wclap.h"
+#include "./hosted-plugin.h"
+#include "./graph-scheduler.h"
+#include "./event-queue.h"
+
+#include <memory>
+#include <vector>
+
+namespace impl32 {
+using namespace wclap32;
+
+/* Runs a DAG of plugins from the same `HostedWclap` in a single call.
+
+Where an input port has exactly one audio connection, it's bound directly to the upstream output buffers (no copying).  Inputs with several connections are mixed into the plugin's own input buffers.  Each event connection has its own queue, which the upstream plugin pushes its output events into and the downstream plugin drains along with its own, so fan-in doesn't need a lock.
+
+Set up with `addPlugin()`/`connectAudio()`/`connectEvents()`, then `compile()` once all the plugins have been started (and again if any of them restart).
+
+A plugin can only be in one graph at a time, and the graph holds plain pointers to its plugins, so tear down in the order: graph, then plugins, then the `HostedWclap` (`destroyPlugin()` refuses while the plugin is still in a graph).
+
+With `setThreads()`, independent branches run in parallel on a `GraphScheduler`.*/
+struct PluginGraph {
+	HostedWclap &hosted;
+
+	PluginGraph(HostedWclap &hosted) : hosted(hosted) {}
+	~PluginGraph() {
+		unbind();
+		for (auto &node : nodes) node.plugin->graph = nullptr;
+	}
+
+	// Returns the node index, or -1 if the plugin doesn't belong to this WCLAP (or is already in a graph)
+	int32_t addPlugin(HostedPlugin *plugin) {
+		if (!plugin || plugin->graph || hosted.pluginLookup.get(int32_t(plugin->pluginIndex)) != plugin) return -1;
+		plugin->graph = this;
+		nodes.push_back({plugin});
+		compiled = false;
+		return int32_t(nodes.size() - 1);
+	}
+	// Connecting the same ports twice is allowed, but only makes one connection
+	bool connectAudio(uint32_t fromNode, uint32_t fromPort, uint32_t toNode, uint32_t toPort) {
+		if (fromNode >= nodes.size() || toNode >= nodes.size() || fromNode == toNode) return false;
+		if (hasConnection(audioConnections, {fromNode, fromPort, toNode, toPort})) return true;
+		audioConnections.push_back({fromNode, fromPort, toNode, toPort});
+		compiled = false;
+		return true;
+	}
+	// Runs independent branches on `threadCount` extra threads (0 = serial).  If a quantum takes longer than `deadlineSeconds`, it falls back to serial for a while.
+	void setThreads(uint32_t threadCount, double deadlineSeconds) {
+		scheduler = nullptr;
+		if (threadCount > 0) {
+			scheduler = std::unique_ptr<GraphScheduler>(new GraphScheduler(threadCount));
+			scheduler->setDeadline(deadlineSeconds);
+		}
+		compiled = false;
+	}
+	bool connectEvents(uint32_t fromNode, uint32_t toNode) {
+		if (fromNode >= nodes.size() || toNode >= nodes.size() || fromNode == toNode) return false;
+		if (hasConnection(eventConnections, {fromNode, 0, toNode, 0})) return true;
+		eventConnections.push_back({fromNode, 0, toNode, 0});
+		compiled = false;
+		return true;
+	}
+
+	// Sorts the nodes topologically and binds buffers/event targets - fails if there's a cycle
+	bool compile(uint32_t maxFrames) {
+		unbind();
+		compiled = false;
+		
+		// Kahn's algorithm
+		std::vector<uint32_t> inDegree(nodes.size(), 0);
+		auto allConnections = audioConnections;
+		allConnections.insert(allConnections.end(), eventConnections.begin(), eventConnections.end());
+		for (auto &c : allConnections) ++inDegree[c.toNode];
+		order.clear();
+		for (uint32_t n = 0; n < nodes.size(); ++n) {
+			if (!inDegree[n]) order.push_back(n);
+		}
+		for (size_t i = 0; i < order.size(); ++i) {
+			for (auto &c : allConnections) {
+				if (c.fromNode == order[i] && !--inDegree[c.toNode]) order.push_back(c.toNode);
+			}
+		}
+		if (order.size() != nodes.size()) {
+			order.clear();
+			return false;
+		}
+		
+		for (auto &node : nodes) node.mixes.clear();
+		for (auto &c : eventConnections) {
+			eventQueues.emplace_back(new EventQueue());
+			nodes[c.fromNode].plugin->eventTargets.push_back(eventQueues.back().get());
+			nodes[c.toNode].plugin->eventSources.push_back(eventQueues.back().get());
+		}
+		// Group the audio connections by destination port
+		for (size_t i = 0; i < audioConnections.size(); ++i) {
+			auto &c = audioConnections[i];
+			bool seen = false, shared = false;
+			for (size_t j = 0; j < audioConnections.size(); ++j) {
+				auto &other = audioConnections[j];
+				if (other.toNode != c.toNode || other.toPort != c.toPort) continue;
+				if (j < i) seen = true;
+				if (j != i) shared = true;
+			}
+			if (seen) continue; // handled along with the first connection to this port
+			auto &to = nodes[c.toNode];
+			if (!shared) {
+				bindPort(c, to);
+			} else {
+				to.mixes.push_back({c.toPort});
+				for (auto &other : audioConnections) {
+					if (other.toNode == c.toNode && other.toPort == c.toPort) to.mixes.back().sources.push_back(other);
+				}
+			}
+		}
+		// Each node has its own scratch buffers, so nodes can mix in parallel
+		for (auto &node : nodes) {
+			node.mixBuffer.assign(node.mixes.empty() ? 0 : maxFrames, 0);
+			node.sourceBuffer.assign(node.mixes.empty() ? 0 : maxFrames, 0);
+		}
+		this->maxFrames = maxFrames;
+
+		if (scheduler) {
+			std::vector<std::vector<uint32_t>> dependents(nodes.size());
+			for (auto &c : allConnections) {
+				auto &list = dependents[c.fromNode];
+				if (std::find(list.begin(), list.end(), c.toNode) == list.end()) list.push_back(c.toNode);
+			}
+			scheduler->setGraph(dependents, [this](uint32_t n){
+				processNode(n);
+			});
+		}
+		compiled = true;
+		return true;
+	}
+
+	uint32_t process(uint32_t blockLength) {
+		if (!compiled || blockLength > maxFrames) return WCLAP_PROCESS_ERROR;
+		currentBlockLength = blockLength;
+		if (scheduler) {
+			scheduler->run(order);
+		} else {
+			for (auto n : order) processNode(n);
+		}
+		uint32_t result = WCLAP_PROCESS_SLEEP;
+		for (auto &node : nodes) {
+			if (node.status == WCLAP_PROCESS_ERROR) return WCLAP_PROCESS_ERROR;
+			result = std::min(result, node.status); // lower values keep the graph running for longer
+		}
+		return result;
+	}
+
+private:
+	struct Connection {
+		uint32_t fromNode, fromPort, toNode, toPort;
+	};
+	struct Mix {
+		uint32_t port;
+		std::vector<Connection> sources;
+	};
+	struct Node {
+		HostedPlugin *plugin;
+		std::vector<Mix> mixes;
+		std::vector<float> mixBuffer = {}, sourceBuffer = {};
+		uint32_t status = WCLAP_PROCESS_CONTINUE;
+	};
+	std::vector<Node> nodes;
+	std::vector<Connection> audioConnections, eventConnections;
+	std::vector<std::unique_ptr<EventQueue>> eventQueues; // one per event connection, while compiled
+	std::vector<uint32_t> order;
+	bool compiled = false;
+	uint32_t maxFrames = 0, currentBlockLength = 0;
+	std::unique_ptr<GraphScheduler> scheduler;
+	
+	static bool hasConnection(const std::vector<Connection> &connections, const Connection &c) {
+		for (auto &other : connections) {
+			if (other.fromNode == c.fromNode && other.fromPort == c.fromPort && other.toNode == c.toNode && other.toPort == c.toPort) return true;
+		}
+		return false;
+	}
+
+	void processNode(uint32_t n) {
+		auto &node = nodes[n];
+		for (auto &mix : node.mixes) mixInto(node, mix, currentBlockLength);
+		node.status = node.plugin->process(currentBlockLength);
+	}
+	
+	uint32_t channelCount(HostedPlugin *plugin, bool isOutput, uint32_t port) {
+		auto &ports = isOutput ? plugin->outputPorts : plugin->inputPorts;
+		return (port < ports.size()) ? ports[port].channelCount : 0;
+	}
+
+	// A single source: the input reads straight from the upstream output
+	void bindPort(const Connection &c, Node &to) {
+		auto *from = nodes[c.fromNode].plugin;
+		auto fromChannels = channelCount(from, true, c.fromPort);
+		auto toChannels = channelCount(to.plugin, false, c.toPort);
+		if (!fromChannels) return;
+		for (uint32_t ch = 0; ch < toChannels; ++ch) {
+			to.plugin->bindAudio(false, c.toPort, ch, from->boundAudio(true, c.fromPort, ch%fromChannels));
+		}
+	}
+	
+	void mixInto(Node &node, const Mix &mix, uint32_t blockLength) {
+		auto *instance = hosted.instance.get();
+		auto toChannels = channelCount(node.plugin, false, mix.port);
+		for (uint32_t ch = 0; ch < toChannels; ++ch) {
+			auto &mixBuffer = node.mixBuffer, &sourceBuffer = node.sourceBuffer;
+			std::fill(mixBuffer.begin(), mixBuffer.begin() + blockLength, 0.0f);
+			for (auto &c : mix.sources) {
+				auto *from = nodes[c.fromNode].plugin;
+				auto fromChannels = channelCount(from, true, c.fromPort);
+				if (!fromChannels) continue;
+				instance->getArray(from->boundAudio(true, c.fromPort, ch%fromChannels), sourceBuffer.data(), blockLength);
+				for (uint32_t i = 0; i < blockLength; ++i) mixBuffer[i] += sourceBuffer[i];
+			}
+			instance->setArray(node.plugin->boundAudio(false, mix.port, ch), mixBuffer.data(), blockLength);
+		}
+	}
+
+	void unbind() {
+		for (auto &c : audioConnections) {
+			auto *to = nodes[c.toNode].plugin;
+			for (uint32_t ch = 0; ch < channelCount(to, false, c.toPort); ++ch) {
+				to->bindAudio(false, c.toPort, ch, {0});
+			}
+		}
+		// A plugin is only ever in this graph, so all its event connections are ours
+		for (auto &node : nodes) {
+			node.plugin->eventTargets.clear();
+			node.plugin->eventSources.clear();
+		}
+		eventQueues.clear();
+	}
+};
+
+} // namespace
+
+using PluginGraph = impl32::PluginGraph;
@@ -0,0 +1,275 @@
+#pragma once
+
+#include "./common.h"
+#include "./arena-accounting.h"
+#include "./state-codec.h"
+#include "wclap/index-lookup.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Streamed state: JS copies directly from/to the Instance's memory, returning the number of bytes (or -1 for an error)
+WCLAP_HOST_IMPORT("stateWrite")
+extern int32_t pluginStateWrite(const void *plugin, uint32_t remotePtr, uint32_t length);
+WCLAP_HOST_IMPORT("stateRead")
+extern int32_t pluginStateRead(const void *plugin, uint32_t remotePtr, uint32_t maxLength);
+
+namespace impl32 {
+using namespace wclap32;
+
+/* One state save/load (or resource fetch) in progress.  Each has its own `wclap_istream`/`wclap_ostream` in the Instance's memory, so several can run at once (e.g. a background save alongside a webview resource).
+
+Bytes go to/from `data`, or straight to JS (`toJs`), optionally through the compressed envelope (see `state-codec.h`).*/
+struct PluginStream {
+	static constexpr size_t jsChunk = 16384;
+
+	Pointer<const wclap_istream> istreamPtr;
+	Pointer<const wclap_ostream> ostreamPtr;
+	Pointer<unsigned char> chunkPtr; // `jsChunk` bytes, for envelope data on its way to/from JS
+	std::vector<unsigned char> data;
+	const void *jsPlugin = nullptr; // passed to the `stateRead`/`stateWrite` imports
+
+	PluginStream(Instance *instance) : instance(instance) {
+		data.reserve(8192);
+	}
+
+	void startWrite(bool toJs, bool compress) {
+		this->toJs = toJs;
+		data.resize(0);
+		failed = false;
+		compressing = compress;
+		if (compress) scratch.resize(StateCodec::blockSize);
+	}
+	// Finishes the envelope (if there is one) after the plugin's finished writing
+	bool finishWrite(bool success) {
+		if (compressing) {
+			if (success) {
+				compressor.finish([&](const unsigned char *bytes, size_t length){
+					sinkWrite(bytes, length);
+				});
+			} else {
+				compressor.reset();
+			}
+			compressing = false;
+		}
+		success = success && !failed;
+		failed = toJs = false;
+		return success;
+	}
+	// Reads `data` (or from JS), checking the start for a compressed envelope - fails if it's a version we can't read
+	bool startRead(bool toJs) {
+		this->toJs = toJs;
+		StateCodec::Format format;
+		pos = 0;
+		peek.resize(0);
+		peekPos = 0;
+		if (toJs) {
+			// Anything read here (if it's not an envelope) is handed back out before reading more from JS
+			peek.resize(StateCodec::headerSize);
+			size_t peekLength = 0;
+			while (peekLength < peek.size()) {
+				auto n = sourceRead(peek.data() + peekLength, peek.size() - peekLength);
+				if (n <= 0) break;
+				peekLength += n;
+			}
+			peek.resize(peekLength);
+			format = StateCodec::detect(peek.data(), peek.size());
+			if (format != StateCodec::RAW) peek.resize(0);
+		} else {
+			format = StateCodec::detect(data.data(), data.size());
+			if (format != StateCodec::RAW) pos = StateCodec::headerSize;
+		}
+		decompressing = (format == StateCodec::COMPRESSED);
+		if (decompressing) {
+			decompressor.start();
+			scratch.resize(StateCodec::blockSize);
+		}
+		return format != StateCodec::UNSUPPORTED;
+	}
+	void finishRead() {
+		decompressing = toJs = false;
+		peek.resize(0);
+		peekPos = 0;
+	}
+
+	int64_t read(Pointer<void> ptr, uint64_t length) {
+		if (decompressing) {
+			length = std::min<uint64_t>(length, scratch.size());
+			auto result = decompressor.read(scratch.data(), size_t(length), [&](unsigned char *bytes, size_t n){
+				return sourceRead(bytes, n);
+			});
+			if (result > 0) instance->setArray(ptr.cast<unsigned char>(), scratch.data(), size_t(result));
+			return result;
+		}
+		if (toJs) {
+			if (peekPos < peek.size()) { // bytes we already read while checking for compression
+				length = std::min<uint64_t>(length, peek.size() - peekPos);
+				instance->setArray(ptr.cast<unsigned char>(), peek.data() + peekPos, length);
+				peekPos += length;
+				return length;
+			}
+			return pluginStateRead(jsPlugin, ptr.wasmPointer, uint32_t(std::min<uint64_t>(length, 0x7FFFFFFF)));
+		}
+		if (pos >= data.size()) return 0;
+		if (pos + length > data.size()) {
+			length = data.size() - pos;
+		}
+		instance->setArray(ptr.cast<unsigned char>(), data.data() + pos, length);
+		pos += length;
+		return length;
+	}
+	int64_t write(Pointer<const void> ptr, uint64_t length) {
+		if (compressing) {
+			// Through the compressor, a piece at a time, so the full raw state is never held here
+			uint64_t done = 0;
+			while (done < length && !failed) {
+				size_t n = size_t(std::min<uint64_t>(length - done, scratch.size()));
+				instance->getArray(Pointer<const unsigned char>{uint32_t(ptr.wasmPointer + done)}, scratch.data(), uint32_t(n));
+				compressor.write(scratch.data(), n, [&](const unsigned char *bytes, size_t length){
+					sinkWrite(bytes, length);
+				});
+				done += n;
+			}
+			return failed ? -1 : int64_t(length);
+		}
+		if (toJs) return pluginStateWrite(jsPlugin, ptr.wasmPointer, uint32_t(std::min<uint64_t>(length, 0x7FFFFFFF)));
+		auto start = data.size();
+		data.resize(start + length);
+		instance->getArray(ptr.cast<const unsigned char>(), data.data() + start, uint32_t(length));
+		return length;
+	}
+
+private:
+	Instance *instance;
+
+	bool toJs = false, compressing = false, decompressing = false, failed = false;
+	size_t pos = 0;
+	StateCompressor compressor;
+	StateDecompressor decompressor;
+	std::vector<unsigned char> scratch; // raw state on its way through the codec
+	std::vector<unsigned char> peek;
+	size_t peekPos = 0;
+
+	// Plain bytes from `data` or JS, below the codec
+	int64_t sourceRead(unsigned char *bytes, size_t length) {
+		if (peekPos < peek.size()) {
+			length = std::min(length, peek.size() - peekPos);
+			std::memcpy(bytes, peek.data() + peekPos, length);
+			peekPos += length;
+			return length;
+		}
+		if (toJs) {
+			length = std::min(length, jsChunk);
+			int32_t result = pluginStateRead(jsPlugin, chunkPtr.wasmPointer, uint32_t(length));
+			if (result > 0) instance->getArray(chunkPtr.cast<const unsigned char>(), bytes, uint32_t(result));
+			return result;
+		}
+		length = std::min(length, data.size() - std::min(pos, data.size()));
+		std::memcpy(bytes, data.data() + pos, length);
+		pos += length;
+		return length;
+	}
+	void sinkWrite(const unsigned char *bytes, size_t length) {
+		if (failed) return;
+		if (!toJs) {
+			data.insert(data.end(), bytes, bytes + length);
+			return;
+		}
+		while (length) {
+			size_t n = std::min(length, jsChunk);
+			instance->setArray(chunkPtr, bytes, n);
+			if (pluginStateWrite(jsPlugin, chunkPtr.wasmPointer, uint32_t(n)) != int32_t(n)) {
+				failed = true;
+				return;
+			}
+			bytes += n;
+			length -= n;
+		}
+	}
+};
+
+/* Reusable `PluginStream`s, shared by all plugins from one module.  The `ctx` of each stream's structs is its index in `lookup`.*/
+struct PluginStreamPool {
+	using ArenaPool = wclap::MemoryArenaPool<Instance, false>;
+	using ArenaPtr = std::unique_ptr<wclap::MemoryArena<Instance, false>>;
+
+	// Templates for the stream structs (function pointers filled in by the host)
+	wclap_istream istream;
+	wclap_ostream ostream;
+	wclap::IndexLookup<PluginStream> lookup;
+
+	PluginStreamPool(Instance *instance, ArenaPool &arenaPool, ArenaAccounting &arenaAccounting) : instance(instance), arenaPool(arenaPool), arenaAccounting(arenaAccounting) {}
+	~PluginStreamPool() {
+		for (auto &arena : arenas) {
+			arenaPool.returnToPool(arena);
+			arenaAccounting.release(ArenaAccounting::KEPT_STREAM, arenaBytes);
+		}
+	}
+
+	PluginStream * acquire(const void *jsPlugin) {
+		std::lock_guard<std::mutex> lock{mutex};
+		PluginStream *stream;
+		if (freeStreams.empty()) {
+			streams.emplace_back(new PluginStream(instance));
+			stream = streams.back().get();
+			auto index = lookup.retain(stream);
+			auto scoped = arenaPool.scoped();
+			auto istreamCopy = istream;
+			istreamCopy.ctx = {index};
+			stream->istreamPtr = scoped.copyAcross(istreamCopy);
+			auto ostreamCopy = ostream;
+			ostreamCopy.ctx = {index};
+			stream->ostreamPtr = scoped.copyAcross(ostreamCopy);
+			stream->chunkPtr = scoped.array<unsigned char>(PluginStream::jsChunk);
+			arenas.push_back(scoped.commit());
+			arenaAccounting.keep(ArenaAccounting::KEPT_STREAM, arenaBytes);
+		} else {
+			stream = freeStreams.back();
+			freeStreams.pop_back();
+		}
+		stream->jsPlugin = jsPlugin;
+		return stream;
+	}
+	void release(PluginStream *stream) {
+		std::lock_guard<std::mutex> lock{mutex};
+		stream->jsPlugin = nullptr;
+		freeStreams.push_back(stream);
+	}
+	struct Stats {
+		size_t streams, free;
+	};
+	Stats stats() {
+		std::lock_guard<std::mutex> lock{mutex};
+		return {streams.size(), freeStreams.size()};
+	}
+
+	// Released when it goes out of scope
+	struct Scoped {
+		PluginStreamPool &pool;
+		PluginStream *stream;
+
+		Scoped(PluginStreamPool &pool, const void *jsPlugin) : pool(pool), stream(pool.acquire(jsPlugin)) {}
+		Scoped(const Scoped &other) = delete;
+		~Scoped() {
+			pool.release(stream);
+		}
+		PluginStream * operator->() {
+			return stream;
+		}
+	};
+
+private:
+	Instance *instance;
+	ArenaPool &arenaPool;
+	ArenaAccounting &arenaAccounting;
+	static constexpr size_t arenaBytes = sizeof(wclap_istream) + sizeof(wclap_ostream) + PluginStream::jsChunk; // one arena per stream
+	std::mutex mutex;
+	std::vector<std::unique_ptr<PluginStream>> streams;
+	std::vector<PluginStream *> freeStreams;
+	std::vector<ArenaPtr> arenas;
+};
+
+} // namespace
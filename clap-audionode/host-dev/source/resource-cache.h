@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/* Webview resources, keyed by path, stored as the already-encoded `getResource()` result so a hit is a single copy.
+
+Bounded by total size, evicting the least-recently-used first.  `flush()` bumps the generation, so a fetch which started before the flush can't put its (possibly stale) result back in.*/
+struct ResourceCache {
+	static constexpr size_t defaultMaxBytes = 32*1024*1024;
+
+	bool get(const std::string &path, std::vector<unsigned char> &encoded) {
+		std::lock_guard<std::mutex> lock{mutex};
+		auto iter = index.find(path);
+		if (iter == index.end()) return false;
+		entries.splice(entries.begin(), entries, iter->second); // most recently used
+		encoded = iter->second->encoded;
+		return true;
+	}
+	// Take this before fetching, and pass it to `put()`
+	uint32_t generation() {
+		std::lock_guard<std::mutex> lock{mutex};
+		return currentGeneration;
+	}
+	void put(const std::string &path, const std::vector<unsigned char> &encoded, uint32_t fetchGeneration) {
+		std::lock_guard<std::mutex> lock{mutex};
+		if (fetchGeneration != currentGeneration || encoded.size() > maxBytes) return;
+		auto iter = index.find(path);
+		if (iter != index.end()) eraseEntry(iter->second);
+		entries.push_front({path, encoded});
+		index[path] = entries.begin();
+		totalBytes += encoded.size();
+		while (totalBytes > maxBytes) eraseEntry(std::prev(entries.end()));
+	}
+	void flush() {
+		std::lock_guard<std::mutex> lock{mutex};
+		entries.clear();
+		index.clear();
+		totalBytes = 0;
+		++currentGeneration;
+	}
+	void setMaxBytes(size_t bytes) {
+		std::lock_guard<std::mutex> lock{mutex};
+		maxBytes = bytes;
+		while (totalBytes > maxBytes) eraseEntry(std::prev(entries.end()));
+	}
+
+private:
+	struct Entry {
+		std::string path;
+		std::vector<unsigned char> encoded;
+	};
+	std::mutex mutex;
+	std::list<Entry> entries; // most recently used first
+	std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	size_t totalBytes = 0, maxBytes = defaultMaxBytes;
+	uint32_t currentGeneration = 0;
+
+	void eraseEntry(std::list<Entry>::iterator iter) {
+		totalBytes -= iter->encoded.size();
+		index.erase(iter->path);
+		entries.erase(iter);
+	}
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+/* Optional compressed envelope for plugin state.
+
+Layout (all little-endian):
+	header: "WCLZ", version (1 byte), 3 reserved bytes
+	blocks: u32 stored size (top bit set if the block is stored uncompressed), u32 raw size, data
+	end: u32 0, u32 Adler-32 of the raw data, u64 raw length
+
+Each block holds up to 64KB of raw data, compressed independently with a simple LZ77 codec (LZ4-style sequences), so both directions stream with bounded memory.  States which don't start with the magic bytes are treated as raw, and an unknown version fails to load.*/
+struct StateCodec {
+	static constexpr size_t blockSize = 65536;
+	static constexpr unsigned char magic[4] = {'W', 'C', 'L', 'Z'};
+	static constexpr unsigned char version = 1;
+	static constexpr size_t headerSize = 8;
+	static constexpr uint32_t storedFlag = 0x80000000u;
+
+	// An envelope from a newer version can't be read, but mustn't be handed to the plugin as raw state either
+	enum Format {RAW, COMPRESSED, UNSUPPORTED};
+	static Format detect(const unsigned char *data, size_t length) {
+		if (length < headerSize || std::memcmp(data, magic, 4)) return RAW;
+		return (data[4] == version) ? COMPRESSED : UNSUPPORTED;
+	}
+
+	struct Adler32 {
+		uint32_t a = 1, b = 0;
+		void add(const unsigned char *data, size_t length) {
+			while (length) {
+				size_t n = (length < 5552) ? length : 5552; // largest run before the sums can overflow
+				length -= n;
+				while (n--) {
+					a += *data++;
+					b += a;
+				}
+				a %= 65521;
+				b %= 65521;
+			}
+		}
+		uint32_t value() const {
+			return (b<<16)|a;
+		}
+	};
+
+	static void writeU32(unsigned char *ptr, uint32_t v) {
+		for (int i = 0; i < 4; ++i) ptr[i] = (unsigned char)(v>>(i*8));
+	}
+	static uint32_t readU32(const unsigned char *ptr) {
+		return uint32_t(ptr[0])|(uint32_t(ptr[1])<<8)|(uint32_t(ptr[2])<<16)|(uint32_t(ptr[3])<<24);
+	}
+
+	// Worst case for a block which doesn't compress (we store it raw instead, but the encoder needs the space)
+	static constexpr size_t maxEncodedSize(size_t length) {
+		return length + length/255 + 16;
+	}
+
+	// LZ4-style sequences: token (literal length << 4 | match length - 4), literals, u16 offset, with 255-runs for long lengths
+	static size_t encodeBlock(const unsigned char *input, size_t length, unsigned char *output) {
+		constexpr int hashBits = 12;
+		constexpr size_t minMatch = 4, endLiterals = 5;
+		uint16_t table[1<<hashBits];
+		std::memset(table, 0, sizeof(table));
+		auto hash4 = [&](size_t pos){
+			uint32_t v;
+			std::memcpy(&v, input + pos, 4);
+			return (v*2654435761u)>>(32 - hashBits);
+		};
+		auto writeLength = [&](unsigned char *&out, size_t extra){
+			while (extra >= 255) {
+				*out++ = 255;
+				extra -= 255;
+			}
+			*out++ = (unsigned char)extra;
+		};
+
+		unsigned char *out = output;
+		size_t anchor = 0, pos = 1;
+		size_t matchLimit = (length > endLiterals + minMatch) ? length - endLiterals : 0;
+		while (pos + minMatch <= matchLimit) {
+			auto h = hash4(pos);
+			size_t candidate = table[h];
+			table[h] = uint16_t(pos);
+			if (candidate >= pos || std::memcmp(input + candidate, input + pos, minMatch)) {
+				++pos;
+				continue;
+			}
+			size_t matchLength = minMatch;
+			while (pos + matchLength < matchLimit && input[candidate + matchLength] == input[pos + matchLength]) ++matchLength;
+
+			size_t literals = pos - anchor;
+			unsigned char *token = out++;
+			*token = (unsigned char)(((literals < 15) ? literals : 15)<<4);
+			if (literals >= 15) writeLength(out, literals - 15);
+			std::memcpy(out, input + anchor, literals);
+			out += literals;
+			uint16_t offset = uint16_t(pos - candidate);
+			*out++ = (unsigned char)offset;
+			*out++ = (unsigned char)(offset>>8);
+			size_t matchCode = matchLength - minMatch;
+			*token |= (unsigned char)((matchCode < 15) ? matchCode : 15);
+			if (matchCode >= 15) writeLength(out, matchCode - 15);
+
+			pos += matchLength;
+			anchor = pos;
+		}
+		// Final literals
+		size_t literals = length - anchor;
+		unsigned char *token = out++;
+		*token = (unsigned char)(((literals < 15) ? literals : 15)<<4);
+		if (literals >= 15) writeLength(out, literals - 15);
+		std::memcpy(out, input + anchor, literals);
+		out += literals;
+		return out - output;
+	}
+	// Returns false if the data is corrupt
+	static bool decodeBlock(const unsigned char *input, size_t inputLength, unsigned char *output, size_t outputLength) {
+		const unsigned char *in = input, *inEnd = input + inputLength;
+		size_t pos = 0;
+		auto readLength = [&](size_t &length) {
+			unsigned char byte;
+			do {
+				if (in >= inEnd) return false;
+				byte = *in++;
+				length += byte;
+			} while (byte == 255);
+			return true;
+		};
+		while (in < inEnd) {
+			unsigned char token = *in++;
+			size_t literals = token>>4;
+			if (literals == 15 && !readLength(literals)) return false;
+			if (literals > size_t(inEnd - in) || literals > outputLength - pos) return false;
+			std::memcpy(output + pos, in, literals);
+			in += literals;
+			pos += literals;
+			if (in == inEnd) break; // last sequence has no match
+			if (inEnd - in < 2) return false;
+			size_t offset = size_t(in[0])|(size_t(in[1])<<8);
+			in += 2;
+			size_t matchLength = token&15;
+			if (matchLength == 15 && !readLength(matchLength)) return false;
+			matchLength += 4;
+			if (!offset || offset > pos || matchLength > outputLength - pos) return false;
+			while (matchLength) { // matches can overlap, so copy at most `offset` bytes at a time
+				size_t n = (matchLength < offset) ? matchLength : offset;
+				std::memcpy(output + pos, output + pos - offset, n);
+				pos += n;
+				matchLength -= n;
+			}
+		}
+		return pos == outputLength;
+	}
+};
+
+// Accepts raw state in any-sized pieces, and emits the envelope in pieces: `emit(const unsigned char *, size_t)`
+struct StateCompressor {
+	template<class Emit>
+	void write(const unsigned char *data, size_t length, Emit &&emit) {
+		if (!started) {
+			if (encoded.empty()) { // allocated on first use, so unused codecs are cheap
+				input.reserve(StateCodec::blockSize);
+				encoded.resize(8 + StateCodec::maxEncodedSize(StateCodec::blockSize));
+			}
+			unsigned char header[StateCodec::headerSize] = {};
+			std::memcpy(header, StateCodec::magic, 4);
+			header[4] = StateCodec::version;
+			emit(header, sizeof(header));
+			started = true;
+		}
+		checksum.add(data, length);
+		totalLength += length;
+		while (length) {
+			size_t n = StateCodec::blockSize - input.size();
+			if (n > length) n = length;
+			input.insert(input.end(), data, data + n);
+			data += n;
+			length -= n;
+			if (input.size() == StateCodec::blockSize) flushBlock(emit);
+		}
+	}
+	template<class Emit>
+	void finish(Emit &&emit) {
+		write(nullptr, 0, emit); // makes sure there's a header
+		if (!input.empty()) flushBlock(emit);
+		unsigned char end[16];
+		StateCodec::writeU32(end, 0);
+		StateCodec::writeU32(end + 4, checksum.value());
+		StateCodec::writeU32(end + 8, uint32_t(totalLength));
+		StateCodec::writeU32(end + 12, uint32_t(totalLength>>32));
+		emit(end, sizeof(end));
+		reset();
+	}
+	void reset() {
+		input.clear();
+		started = false;
+		checksum = {};
+		totalLength = 0;
+	}
+
+private:
+	std::vector<unsigned char> input, encoded;
+	bool started = false;
+	StateCodec::Adler32 checksum;
+	uint64_t totalLength = 0;
+
+	template<class Emit>
+	void flushBlock(Emit &&emit) {
+		size_t size = StateCodec::encodeBlock(input.data(), input.size(), encoded.data() + 8);
+		if (size >= input.size()) { // incompressible: store it as-is
+			size = input.size();
+			std::memcpy(encoded.data() + 8, input.data(), size);
+			StateCodec::writeU32(encoded.data(), uint32_t(size)|StateCodec::storedFlag);
+		} else {
+			StateCodec::writeU32(encoded.data(), uint32_t(size));
+		}
+		StateCodec::writeU32(encoded.data() + 4, uint32_t(input.size()));
+		emit(encoded.data(), 8 + size);
+		input.clear();
+	}
+};
+
+// Pulls the envelope from `source(unsigned char *, size_t) -> int64_t` (which returns fewer bytes only at the end), and returns raw state in any-sized pieces
+struct StateDecompressor {
+	// Call once the header has been read (and checked with `StateCodec::detect()`)
+	void start() {
+		if (decoded.empty()) {
+			encoded.resize(StateCodec::maxEncodedSize(StateCodec::blockSize));
+			decoded.resize(StateCodec::blockSize);
+		}
+		decodedPos = decodedLength = 0;
+		finished = failed = false;
+		checksum = {};
+		totalLength = 0;
+	}
+	// Returns -1 for corrupt data (including a checksum mismatch at the end), 0 at the end
+	template<class Source>
+	int64_t read(unsigned char *output, size_t length, Source &&source) {
+		if (failed) return -1;
+		if (decodedPos == decodedLength) {
+			if (finished) return 0;
+			if (!nextBlock(source)) {
+				failed = true;
+				return -1;
+			}
+			if (finished) return 0;
+		}
+		size_t n = decodedLength - decodedPos;
+		if (n > length) n = length;
+		std::memcpy(output, decoded.data() + decodedPos, n);
+		decodedPos += n;
+		return int64_t(n);
+	}
+
+private:
+	std::vector<unsigned char> encoded, decoded;
+	size_t decodedPos = 0, decodedLength = 0;
+	bool finished = false, failed = false;
+	StateCodec::Adler32 checksum;
+	uint64_t totalLength = 0;
+
+	template<class Source>
+	static bool readExactly(Source &source, unsigned char *ptr, size_t length) {
+		while (length) {
+			int64_t n = source(ptr, length);
+			if (n <= 0) return false;
+			ptr += n;
+			length -= size_t(n);
+		}
+		return true;
+	}
+	template<class Source>
+	bool nextBlock(Source &source) {
+		unsigned char blockHeader[8];
+		if (!readExactly(source, blockHeader, 4)) return false;
+		uint32_t stored = StateCodec::readU32(blockHeader);
+		if (!stored) {
+			unsigned char end[12];
+			if (!readExactly(source, end, sizeof(end))) return false;
+			uint64_t expectedLength = StateCodec::readU32(end + 4)|(uint64_t(StateCodec::readU32(end + 8))<<32);
+			finished = true;
+			decodedPos = decodedLength = 0;
+			return StateCodec::readU32(end) == checksum.value() && expectedLength == totalLength;
+		}
+		if (!readExactly(source, blockHeader + 4, 4)) return false;
+		bool isStored = stored&StateCodec::storedFlag;
+		size_t size = stored&~StateCodec::storedFlag;
+		size_t rawSize = StateCodec::readU32(blockHeader + 4);
+		if (rawSize > StateCodec::blockSize || size > encoded.size() || (isStored && size != rawSize)) return false;
+		if (isStored) {
+			if (!readExactly(source, decoded.data(), size)) return false;
+		} else {
+			if (!readExactly(source, encoded.data(), size)) return false;
+			if (!StateCodec::decodeBlock(encoded.data(), size, decoded.data(), rawSize)) return false;
+		}
+		checksum.add(decoded.data(), rawSize);
+		totalLength += rawSize;
+		decodedPos = 0;
+		decodedLength = rawSize;
+		return true;
+	}
+};
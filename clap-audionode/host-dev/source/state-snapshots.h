@@ -0,0 +1,165 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+/* Stores many versions of a plugin's state (e.g. undo history), sharing the parts which are identical.
+
+States are split using content-defined chunking (a "gear" rolling hash picks the boundaries, so an edit only changes the chunks around it), and identical chunks are stored once, with a reference count.  Memory therefore grows with the size of each edit, not the size of the state.*/
+struct StateSnapshots {
+	static constexpr size_t minChunk = 2048, maxChunk = 65536;
+	// ~8KB average chunk (after `minChunk`) - uses the top bits, which depend on the last 64 bytes
+	static constexpr uint64_t boundaryMask = uint64_t((1<<13) - 1)<<(64 - 13);
+
+	struct Stats {
+		size_t snapshots = 0, chunks = 0;
+		size_t storedBytes = 0; // unique chunk data
+		size_t snapshotBytes = 0; // total size of all snapshots, as if stored separately
+	};
+
+	// The content hash only picks where a chunk is stored (collisions are probed past), so it can be replaced - e.g. with a weak one for testing
+	using HashFn = uint64_t (*)(const unsigned char *data, size_t length);
+	StateSnapshots(HashFn hashFn=contentHash) : hashFn(hashFn) {}
+
+	// Returns an ID (never 0)
+	uint32_t add(const unsigned char *data, size_t length) {
+		Snapshot snapshot;
+		snapshot.length = length;
+		size_t pos = 0;
+		while (pos < length) {
+			size_t chunkLength = nextBoundary(data + pos, length - pos);
+			snapshot.chunks.push_back(retainChunk(data + pos, chunkLength));
+			pos += chunkLength;
+		}
+		uint32_t id = nextId++;
+		if (!nextId) nextId = 1;
+		snapshotBytes += length;
+		snapshots.emplace(id, std::move(snapshot));
+		return id;
+	}
+	bool get(uint32_t id, std::vector<unsigned char> &buffer) const {
+		auto iter = snapshots.find(id);
+		if (iter == snapshots.end()) return false;
+		buffer.resize(iter->second.length);
+		size_t pos = 0;
+		for (auto key : iter->second.chunks) {
+			auto &bytes = chunks.at(key).bytes;
+			std::memcpy(buffer.data() + pos, bytes.data(), bytes.size());
+			pos += bytes.size();
+		}
+		return true;
+	}
+	bool remove(uint32_t id) {
+		auto iter = snapshots.find(id);
+		if (iter == snapshots.end()) return false;
+		for (auto key : iter->second.chunks) releaseChunk(key);
+		snapshotBytes -= iter->second.length;
+		snapshots.erase(iter);
+		return true;
+	}
+	void clear() {
+		snapshots.clear();
+		chunks.clear();
+		liveChunks = storedBytes = snapshotBytes = 0;
+	}
+
+	Stats stats() const {
+		return {snapshots.size(), liveChunks, storedBytes, snapshotBytes};
+	}
+
+	static uint64_t contentHash(const unsigned char *data, size_t length) {
+		uint64_t hash = 0xCBF29CE484222325ull^length; // FNV-1a
+		for (size_t i = 0; i < length; ++i) {
+			hash = (hash^data[i])*0x100000001B3ull;
+		}
+		return hash;
+	}
+
+private:
+	// Unused chunks with a used one after them are kept (empty) as tombstones, so they don't break the probe sequence for colliding hashes
+	struct Chunk {
+		std::vector<unsigned char> bytes;
+		size_t refCount = 0;
+	};
+	struct Snapshot {
+		size_t length = 0;
+		std::vector<uint64_t> chunks;
+	};
+	std::unordered_map<uint64_t, Chunk> chunks;
+	std::unordered_map<uint32_t, Snapshot> snapshots;
+	uint32_t nextId = 1;
+	size_t liveChunks = 0, storedBytes = 0, snapshotBytes = 0;
+	HashFn hashFn;
+
+	static const std::array<uint64_t, 256> & gearTable() {
+		static const std::array<uint64_t, 256> table = [](){
+			std::array<uint64_t, 256> table;
+			uint64_t x = 0x9E3779B97F4A7C15ull; // splitmix64, so it's the same on every platform
+			for (auto &v : table) {
+				x += 0x9E3779B97F4A7C15ull;
+				uint64_t z = x;
+				z = (z^(z>>30))*0xBF58476D1CE4E5B9ull;
+				z = (z^(z>>27))*0x94D049BB133111EBull;
+				v = z^(z>>31);
+			}
+			return table;
+		}();
+		return table;
+	}
+	static size_t nextBoundary(const unsigned char *data, size_t length) {
+		if (length <= minChunk) return length;
+		auto &gear = gearTable();
+		size_t end = std::min(length, maxChunk);
+		uint64_t hash = 0;
+		for (size_t i = minChunk; i < end; ++i) {
+			hash = (hash<<1) + gear[data[i]];
+			if (!(hash&boundaryMask)) return i + 1;
+		}
+		return end;
+	}
+	uint64_t retainChunk(const unsigned char *data, size_t length) {
+		uint64_t key = hashFn(data, length);
+		Chunk *tombstone = nullptr;
+		uint64_t tombstoneKey = 0;
+		while (true) {
+			auto iter = chunks.find(key);
+			if (iter == chunks.end()) break;
+			auto &chunk = iter->second;
+			if (!chunk.refCount) {
+				if (!tombstone) {
+					tombstone = &chunk;
+					tombstoneKey = key;
+				}
+			} else if (chunk.bytes.size() == length && !std::memcmp(chunk.bytes.data(), data, length)) {
+				++chunk.refCount;
+				return key;
+			}
+			++key; // hash collision: probe for the next free/matching key
+		}
+		// Not stored yet: reuse the first tombstone we passed, if any
+		if (tombstone) key = tombstoneKey;
+		auto &chunk = tombstone ? *tombstone : chunks[key];
+		chunk.bytes.assign(data, data + length);
+		chunk.refCount = 1;
+		++liveChunks;
+		storedBytes += length;
+		return key;
+	}
+	void releaseChunk(uint64_t key) {
+		auto iter = chunks.find(key);
+		if (iter == chunks.end() || !iter->second.refCount) return;
+		if (--iter->second.refCount) return;
+		--liveChunks;
+		storedBytes -= iter->second.bytes.size();
+		std::vector<unsigned char>().swap(iter->second.bytes);
+		// Only the end of a probe sequence can actually be erased, along with any tombstones before it
+		while (iter != chunks.end() && !iter->second.refCount && !chunks.count(key + 1)) {
+			chunks.erase(iter);
+			iter = chunks.find(--key);
+		}
+	}
+};
@@ -15,6 +15,12 @@ export function hostImports() {
 			},
 			paramsRescan: (pluginPtr, flags) => {
 				throw Error("paramsRescan");
+			},
+			stateWrite: (pluginPtr, ptr, length) => {
+				throw Error("stateWrite");
+			},
+			stateRead: (pluginPtr, ptr, maxLength) => {
+				throw Error("stateRead");
 			}
 		}
 	};